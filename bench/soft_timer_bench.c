@@ -0,0 +1,438 @@
+/**
+ * @file soft_timer_bench.c
+ *
+ * @brief Benchmark of start, stop and interrupt cost versus the number of
+ * pending software timers.
+ *
+ * The benchmark runs over the virtual-time hardware layer, so the clock
+ * jumps from expiry to expiry and only the software timer is measured. Each
+ * mix is run from 1 up to 100000 timers:
+ *
+ *   uniform    one-shot timers with random timeouts, started, stopped in a
+ *              random order, then started again and left to expire.
+ *   heartbeat  periodic timers of 10 ms to 1 s, left to run for 2 s.
+ *   timeout    one-shot timeouts of 1 s to 30 s that are mostly restarted
+ *              before they expire, like protocol or watchdog timeouts.
+ *   keepalive  the same timeouts, refreshed with soft_timer_restart(),
+ *              timed as starts.
+ *   burst      timers with the same timeout, started at once.
+ *
+ * Start and stop are averaged per call, the interrupt per run of the
+ * handler, with its worst case. Times are given in nanoseconds and, on
+ * x86, in TSC cycles. Memory is the one held by the pool and the queue,
+ * plus the soft_timer of the user, divided by the number of timers. Every
+ * run is made by a process of its own, so the pool only holds the chunks
+ * needed by the timers of that run.
+ *
+ *   make bench [ENGINE=WHEEL]
+ *   build/soft_timer_bench_HEAP [--json]
+ *
+ * The output is CSV with a header line, or one JSON object per line.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "soft_timer.h"
+#include "hmcu_timer.h"
+#include "hmcu_timer_sim.h"
+
+/*****************************************************************************
+ * Private constants.
+ *****************************************************************************/
+#define BENCH_MAX_TIMERS		100000
+#define BENCH_MAX_RELOAD_MS		100000
+#define BENCH_HEARTBEAT_MS		2000
+#define BENCH_TIMEOUT_OPS		100000
+#define BENCH_BURST_MS			100
+
+#if (SOFT_TIMER_ENGINE == SOFT_TIMER_ENGINE_WHEEL)
+#define BENCH_ENGINE			"wheel"
+#else
+#define BENCH_ENGINE			"heap"
+#endif
+
+/*****************************************************************************
+ * Private types.
+ *****************************************************************************/
+typedef struct bench_cost{
+	double					ns;
+	double					cycles;
+	uint64_t				calls;
+}bench_cost;
+
+typedef struct bench_result{
+	const char				* mix;
+	uint32_t				timers;
+	bench_cost				start;
+	bench_cost				stop;
+	bench_cost				irq;
+	double					irq_max_ns;
+	double					irq_max_cycles;
+	uint64_t				fires;
+	double					bytes_per_timer;
+}bench_result;
+
+/*****************************************************************************
+ * Global variables.
+ *****************************************************************************/
+static soft_timer			bench_timers[BENCH_MAX_TIMERS];
+static uint32_t				bench_order[BENCH_MAX_TIMERS];
+static uint64_t				bench_fired = 0;
+static uint32_t				bench_seed = 2463534242u;
+static bool					bench_json = false;
+
+/*****************************************************************************
+ * Bodies of private functions.
+ *****************************************************************************/
+
+static uint32_t bench_random(void){
+
+	/* Xorshift, so every run uses the same sequence. */
+	bench_seed ^= bench_seed << 13;
+	bench_seed ^= bench_seed >> 17;
+	bench_seed ^= bench_seed << 5;
+	return bench_seed;
+}
+
+static double bench_nanoseconds(void){
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec*1e9 + (double)ts.tv_nsec;
+}
+
+static uint64_t bench_cycles(void){
+
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static void bench_callback(soft_timer_t *p_timer){
+
+	(void)p_timer;
+	bench_fired++;
+}
+
+static void bench_shuffle(uint32_t qty){
+
+	uint32_t i, j, tmp;
+
+	/* Visit the timers in a random order, so stops hit the whole queue. */
+	for(i = 0 ; i < qty ; i++){
+		bench_order[i] = i;
+	}
+	for(i = qty - 1 ; i > 0 ; i--){
+		j = bench_random() % (i + 1);
+		tmp = bench_order[i];
+		bench_order[i] = bench_order[j];
+		bench_order[j] = tmp;
+	}
+}
+
+static void bench_startAll(bench_result * p_result, uint32_t qty){
+
+	uint32_t i;
+	double t0;
+	uint64_t c0;
+
+	t0 = bench_nanoseconds();
+	c0 = bench_cycles();
+	for(i = 0 ; i < qty ; i++){
+		soft_timer_start(&bench_timers[i]);
+	}
+	p_result->start.cycles += (double)(bench_cycles() - c0);
+	p_result->start.ns += bench_nanoseconds() - t0;
+	p_result->start.calls += qty;
+}
+
+static void bench_stopAll(bench_result * p_result, uint32_t qty){
+
+	uint32_t i;
+	double t0;
+	uint64_t c0;
+
+	bench_shuffle(qty);
+	t0 = bench_nanoseconds();
+	c0 = bench_cycles();
+	for(i = 0 ; i < qty ; i++){
+		soft_timer_stop(&bench_timers[bench_order[i]]);
+	}
+	p_result->stop.cycles += (double)(bench_cycles() - c0);
+	p_result->stop.ns += bench_nanoseconds() - t0;
+	p_result->stop.calls += qty;
+}
+
+static void bench_advance(bench_result * p_result, uint64_t time_us,
+						  uint64_t fires){
+
+	double t0, ns;
+	uint64_t c0, cycles;
+
+	/* Run every interrupt up to the time, or until the number of fires is
+	 * reached, timing each run of the handler. */
+	while((hmcu_sim_nextExpiry() <= time_us) && (bench_fired < fires)){
+		t0 = bench_nanoseconds();
+		c0 = bench_cycles();
+		hmcu_sim_step();
+		cycles = bench_cycles() - c0;
+		ns = bench_nanoseconds() - t0;
+		p_result->irq.ns += ns;
+		p_result->irq.cycles += (double)cycles;
+		p_result->irq.calls++;
+		if(ns > p_result->irq_max_ns){
+			p_result->irq_max_ns = ns;
+		}
+		if((double)cycles > p_result->irq_max_cycles){
+			p_result->irq_max_cycles = (double)cycles;
+		}
+	}
+	if(time_us != UINT64_MAX){
+		hmcu_sim_runUntil(time_us);
+	}
+}
+
+static void bench_prepare(bench_result * p_result, const char * mix,
+						  uint32_t qty){
+
+	soft_timer_pool_stats_t stats;
+	uint32_t i;
+
+	memset(p_result, 0, sizeof(bench_result));
+	p_result->mix = mix;
+	p_result->timers = qty;
+
+	/* The hardware layer restarts the virtual clock on every init. */
+	soft_timer_init();
+	for(i = 0 ; i < qty ; i++){
+		soft_timer_create(&bench_timers[i]);
+	}
+	soft_timer_get_pool_stats(&stats);
+	p_result->bytes_per_timer = (double)stats.bytes/qty + sizeof(soft_timer);
+	bench_fired = 0;
+}
+
+static void bench_finish(bench_result * p_result, uint32_t qty){
+
+	uint32_t i;
+
+	p_result->fires = bench_fired;
+	for(i = 0 ; i < qty ; i++){
+		soft_timer_stop(&bench_timers[i]);
+		soft_timer_destroy(&bench_timers[i]);
+	}
+}
+
+static void bench_uniform(bench_result * p_result, uint32_t qty){
+
+	uint32_t i;
+
+	bench_prepare(p_result, "uniform", qty);
+	for(i = 0 ; i < qty ; i++){
+		soft_timer_set(&bench_timers[i], bench_callback,
+					   1 + bench_random() % BENCH_MAX_RELOAD_MS, false);
+	}
+
+	bench_startAll(p_result, qty);
+	bench_stopAll(p_result, qty);
+	bench_startAll(p_result, qty);
+	bench_advance(p_result, UINT64_MAX, qty);
+	bench_finish(p_result, qty);
+}
+
+static void bench_heartbeat(bench_result * p_result, uint32_t qty){
+
+	static const uint32_t periods_ms[] = {10, 20, 50, 100, 250, 500, 1000};
+	uint32_t i;
+
+	bench_prepare(p_result, "heartbeat", qty);
+	for(i = 0 ; i < qty ; i++){
+		soft_timer_set(&bench_timers[i], bench_callback,
+					   periods_ms[bench_random() % 7], true);
+	}
+
+	bench_startAll(p_result, qty);
+	bench_advance(p_result, (uint64_t)BENCH_HEARTBEAT_MS*1000u, UINT64_MAX);
+	bench_stopAll(p_result, qty);
+	bench_finish(p_result, qty);
+}
+
+static void bench_timeout(bench_result * p_result, uint32_t qty){
+
+	uint32_t i, k;
+	double t0;
+	uint64_t c0;
+
+	bench_prepare(p_result, "timeout", qty);
+	for(i = 0 ; i < qty ; i++){
+		soft_timer_set(&bench_timers[i], bench_callback,
+					   1000 + bench_random() % 29000, false);
+	}
+	bench_startAll(p_result, qty);
+
+	/* Restart random timers, as traffic arrives, 64 restarts per
+	 * millisecond. Timing each call on its own would measure the clock,
+	 * so stops and starts are timed in blocks. */
+	for(k = 0 ; k < BENCH_TIMEOUT_OPS ; k += 64){
+		for(i = 0 ; i < 64 ; i++){
+			bench_order[i] = bench_random() % qty;
+		}
+		t0 = bench_nanoseconds();
+		c0 = bench_cycles();
+		for(i = 0 ; i < 64 ; i++){
+			soft_timer_stop(&bench_timers[bench_order[i]]);
+		}
+		p_result->stop.cycles += (double)(bench_cycles() - c0);
+		p_result->stop.ns += bench_nanoseconds() - t0;
+		p_result->stop.calls += 64;
+
+		t0 = bench_nanoseconds();
+		c0 = bench_cycles();
+		for(i = 0 ; i < 64 ; i++){
+			soft_timer_start(&bench_timers[bench_order[i]]);
+		}
+		p_result->start.cycles += (double)(bench_cycles() - c0);
+		p_result->start.ns += bench_nanoseconds() - t0;
+		p_result->start.calls += 64;
+
+		bench_advance(p_result, hmcu_sim_now() + 1000u, UINT64_MAX);
+	}
+	bench_finish(p_result, qty);
+}
+
+static void bench_keepalive(bench_result * p_result, uint32_t qty){
+
+	uint32_t i, k;
+	double t0;
+	uint64_t c0;
+
+	bench_prepare(p_result, "keepalive", qty);
+	for(i = 0 ; i < qty ; i++){
+		soft_timer_set(&bench_timers[i], bench_callback,
+					   1000 + bench_random() % 29000, false);
+	}
+	bench_startAll(p_result, qty);
+
+	/* Refresh random timers at the same rate as the timeout mix, with a
+	 * single restart instead of a stop and a start. */
+	for(k = 0 ; k < BENCH_TIMEOUT_OPS ; k += 64){
+		for(i = 0 ; i < 64 ; i++){
+			bench_order[i] = bench_random() % qty;
+		}
+		t0 = bench_nanoseconds();
+		c0 = bench_cycles();
+		for(i = 0 ; i < 64 ; i++){
+			soft_timer_restart(&bench_timers[bench_order[i]]);
+		}
+		p_result->start.cycles += (double)(bench_cycles() - c0);
+		p_result->start.ns += bench_nanoseconds() - t0;
+		p_result->start.calls += 64;
+
+		bench_advance(p_result, hmcu_sim_now() + 1000u, UINT64_MAX);
+	}
+	bench_finish(p_result, qty);
+}
+
+static void bench_burst(bench_result * p_result, uint32_t qty){
+
+	uint32_t i;
+
+	bench_prepare(p_result, "burst", qty);
+	for(i = 0 ; i < qty ; i++){
+		soft_timer_set(&bench_timers[i], bench_callback, BENCH_BURST_MS,
+					   false);
+	}
+
+	bench_startAll(p_result, qty);
+	bench_advance(p_result, UINT64_MAX, qty);
+	bench_finish(p_result, qty);
+}
+
+static double bench_average(double total, uint64_t calls){
+
+	return (calls != 0) ? total/(double)calls : 0.0;
+}
+
+static void bench_print(const bench_result * p_result){
+
+	const char * format = bench_json ?
+		"{\"engine\":\"%s\",\"mix\":\"%s\",\"timers\":%lu,"
+		"\"start_ns\":%.1f,\"start_cycles\":%.1f,"
+		"\"stop_ns\":%.1f,\"stop_cycles\":%.1f,"
+		"\"irq_ns\":%.1f,\"irq_cycles\":%.1f,"
+		"\"irq_max_ns\":%.1f,\"irq_max_cycles\":%.1f,"
+		"\"irqs\":%llu,\"fires\":%llu,\"bytes_per_timer\":%.1f}\n" :
+		"%s,%s,%lu,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%llu,%llu,%.1f\n";
+
+	printf(format, BENCH_ENGINE, p_result->mix,
+		   (unsigned long)p_result->timers,
+		   bench_average(p_result->start.ns, p_result->start.calls),
+		   bench_average(p_result->start.cycles, p_result->start.calls),
+		   bench_average(p_result->stop.ns, p_result->stop.calls),
+		   bench_average(p_result->stop.cycles, p_result->stop.calls),
+		   bench_average(p_result->irq.ns, p_result->irq.calls),
+		   bench_average(p_result->irq.cycles, p_result->irq.calls),
+		   p_result->irq_max_ns, p_result->irq_max_cycles,
+		   (unsigned long long)p_result->irq.calls,
+		   (unsigned long long)p_result->fires,
+		   p_result->bytes_per_timer);
+	fflush(stdout);
+}
+
+int main(int argc, char **argv){
+
+	static void (* const mixes[])(bench_result *, uint32_t) =
+		{bench_uniform, bench_heartbeat, bench_timeout, bench_keepalive,
+		 bench_burst};
+	bench_result result;
+	uint32_t qty, i;
+	pid_t child;
+	int status;
+
+	bench_json = (argc > 1) && (strcmp(argv[1], "--json") == 0);
+	if(!bench_json){
+		printf("engine,mix,timers,start_ns,start_cycles,stop_ns,stop_cycles,"
+			   "irq_ns,irq_cycles,irq_max_ns,irq_max_cycles,irqs,fires,"
+			   "bytes_per_timer\n");
+	}
+
+	for(i = 0 ; i < sizeof(mixes)/sizeof(mixes[0]) ; i++){
+		for(qty = 1 ; qty <= BENCH_MAX_TIMERS ; qty *= 10){
+			if(qty > SOFT_TIMER_MAX_INSTANCES){
+				break;
+			}
+
+			/* The chunks of the scalable pool are kept once allocated, so
+			 * the run is made by a child, which starts with an empty pool. */
+			fflush(stdout);
+			child = fork();
+			if(child == 0){
+				mixes[i](&result, qty);
+				bench_print(&result);
+				_exit(0);
+			}
+			if((child < 0) || (waitpid(child, &status, 0) != child) ||
+			   !WIFEXITED(status) || (WEXITSTATUS(status) != 0)){
+				fprintf(stderr, "run of %u timers failed\n", (unsigned)qty);
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
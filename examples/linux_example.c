@@ -0,0 +1,104 @@
+/**
+ * @file linux_example.c
+ *
+ * @brief Example of the software timer running on a Linux host.
+ *
+ * Two repeating timers and a one-shot timer run for a few seconds, with
+ * the interrupt emulated by hmcu_timer_linux.c. Build it with `make` from
+ * the top directory.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "soft_timer.h"
+
+/*****************************************************************************
+ * Global variables.
+ *****************************************************************************/
+static soft_timer				timer_fast;
+static soft_timer				timer_slow;
+static soft_timer				timer_end;
+static volatile unsigned long	fast_count = 0;
+static volatile unsigned long	slow_count = 0;
+static volatile bool			finished = false;
+
+#if (SOFT_TIMER_TRACE)
+static soft_timer_trace_record_t	trace[SOFT_TIMER_TRACE_SIZE];
+#endif
+
+/*****************************************************************************
+ * Bodies of private functions.
+ *****************************************************************************/
+
+static void fast_cb(soft_timer_t *p_timer){
+
+	(void)p_timer;
+	fast_count++;
+}
+
+static void slow_cb(soft_timer_t *p_timer){
+
+	(void)p_timer;
+	slow_count++;
+}
+
+static void end_cb(soft_timer_t *p_timer){
+
+	(void)p_timer;
+	finished = true;
+}
+
+int main(void){
+
+#if (SOFT_TIMER_TRACE)
+	FILE * file;
+	uint32_t records;
+#endif
+
+	soft_timer_init();
+#if (SOFT_TIMER_SHARDED)
+	soft_timer_shard_attach(0);
+#endif
+
+	soft_timer_create(&timer_fast);
+	soft_timer_create(&timer_slow);
+	soft_timer_create(&timer_end);
+
+	soft_timer_set(&timer_fast, fast_cb, 10, true);
+	soft_timer_set(&timer_slow, slow_cb, 250, true);
+	soft_timer_set(&timer_end, end_cb, 3000, false);
+
+	soft_timer_start(&timer_fast);
+	soft_timer_start(&timer_slow);
+	soft_timer_start(&timer_end);
+
+	/* The callbacks run from the signal handler, which interrupts the
+	 * sleep like an interrupt wakes up a MCU. In deferred mode the signal
+	 * handler only queues the expired timers, and the callbacks run here. */
+	while(!finished){
+		soft_timer_idle();
+#if (SOFT_TIMER_DEFERRED)
+		soft_timer_dispatch();
+#endif
+	}
+
+	soft_timer_stop(&timer_fast);
+	soft_timer_stop(&timer_slow);
+
+	printf("10 ms timer fired %lu times, 250 ms timer fired %lu times\n",
+		   fast_count, slow_count);
+
+#if (SOFT_TIMER_TRACE)
+	/* Write the last events, to be decoded by tools/soft_timer_trace.c. */
+	file = fopen("linux_example.trace", "wb");
+	if(file != NULL){
+		records = soft_timer_trace_dump(trace, SOFT_TIMER_TRACE_SIZE);
+		fwrite(trace, sizeof(trace[0]), records, file);
+		fclose(file);
+	}
+#endif
+
+	return 0;
+}
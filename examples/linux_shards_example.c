@@ -0,0 +1,121 @@
+/**
+ * @file linux_shards_example.c
+ *
+ * @brief Example of the sharded software timer on a Linux host.
+ *
+ * Every worker thread owns a shard, with a repeating heartbeat and a one-shot
+ * kick of its own. At every beat it starts the kick of the next shard, which
+ * is handed off to that shard and applied by its interrupt. The workers
+ * stop beating together before they leave, since a kick handed off to a
+ * shard raises a signal at the thread owning it. Build it with
+ * `make SHARDED=1` from the top directory.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "soft_timer.h"
+
+/*****************************************************************************
+ * Private constants.
+ *****************************************************************************/
+#define SHARDS		SOFT_TIMER_CHANNELS
+
+/*****************************************************************************
+ * Global variables.
+ *****************************************************************************/
+static soft_timer				timer_beat[SHARDS];
+static soft_timer				timer_kick[SHARDS];
+static soft_timer				timer_end[SHARDS];
+static volatile unsigned long	beat_count[SHARDS];
+static volatile unsigned long	kick_count[SHARDS];
+static volatile bool			finished[SHARDS];
+static pthread_barrier_t		created;
+static pthread_barrier_t		stopped;
+
+/*****************************************************************************
+ * Bodies of private functions.
+ *****************************************************************************/
+
+static void beat_cb(soft_timer_t *p_timer){
+
+	uint8_t shard = (uint8_t)(p_timer - timer_beat);
+
+	/* The kick belongs to the next shard, so it is only queued here. */
+	beat_count[shard]++;
+	soft_timer_start(&timer_kick[(shard + 1) % SHARDS]);
+}
+
+static void kick_cb(soft_timer_t *p_timer){
+
+	kick_count[p_timer - timer_kick]++;
+}
+
+static void end_cb(soft_timer_t *p_timer){
+
+	finished[p_timer - timer_end] = true;
+}
+
+static void * worker(void *arg){
+
+	uint8_t shard = (uint8_t)(uintptr_t)arg;
+
+	soft_timer_shard_attach(shard);
+
+	soft_timer_create(&timer_beat[shard]);
+	soft_timer_create(&timer_kick[shard]);
+	soft_timer_create(&timer_end[shard]);
+
+	soft_timer_set(&timer_beat[shard], beat_cb, 10, true);
+	soft_timer_set(&timer_kick[shard], kick_cb, 1, false);
+	soft_timer_set(&timer_end[shard], end_cb, 2000, false);
+
+	/* Every kick has to exist before any beat starts it. */
+	pthread_barrier_wait(&created);
+
+	soft_timer_start(&timer_beat[shard]);
+	soft_timer_start(&timer_end[shard]);
+
+	while(!finished[shard]){
+		soft_timer_idle();
+#if (SOFT_TIMER_DEFERRED)
+		soft_timer_dispatch();
+#endif
+	}
+
+	/* No kick may be handed off to a shard whose thread left, so every
+	 * shard waits for the others to stop beating, and only then stops the
+	 * kick they may have started meanwhile. */
+	soft_timer_stop(&timer_beat[shard]);
+	pthread_barrier_wait(&stopped);
+	soft_timer_stop(&timer_kick[shard]);
+
+	return NULL;
+}
+
+int main(void){
+
+	pthread_t threads[SHARDS];
+	uint8_t shard;
+
+	soft_timer_init();
+	pthread_barrier_init(&created, NULL, SHARDS);
+	pthread_barrier_init(&stopped, NULL, SHARDS);
+
+	for(shard = 0 ; shard < SHARDS; shard++){
+		pthread_create(&threads[shard], NULL, worker,
+					   (void *)(uintptr_t)shard);
+	}
+	for(shard = 0 ; shard < SHARDS; shard++){
+		pthread_join(threads[shard], NULL);
+	}
+
+	for(shard = 0 ; shard < SHARDS; shard++){
+		printf("shard %u: 10 ms timer fired %lu times, kicked %lu times\n",
+			   shard, beat_count[shard], kick_count[shard]);
+	}
+
+	return 0;
+}
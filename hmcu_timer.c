@@ -8,82 +8,232 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include "soft_timer.h"
+#include "hmcu_timer.h"
 
 /*****************************************************************************
  * Libraries needed by hardware MCU
  *****************************************************************************/
 #include <inc/hw_memmap.h>
+#include <inc/hw_ints.h>
 #include <inc/tm4c123gh6pm.h>
 #include <driverlib/sysctl.h>
 #include <driverlib/timer.h>
 #include <driverlib/interrupt.h>
 
+/*****************************************************************************
+ * Private macros.
+ *****************************************************************************/
+#if (SOFT_TIMER_CHANNELS > 6)
+#error "The TM4C123 has six 16/32-bit timers, so up to six channels."
+#endif
+
+/*****************************************************************************
+ * Global variables.
+ *****************************************************************************/
+/* Hardware timer of each channel, and its interrupt. The interrupts of the
+ * timers are not contiguous. */
+static const uint32_t hw_bases[] = {
+	TIMER0_BASE, TIMER1_BASE, TIMER2_BASE,
+	TIMER3_BASE, TIMER4_BASE, TIMER5_BASE
+};
+static const uint32_t hw_ints[] = {
+	INT_TIMER0A, INT_TIMER1A, INT_TIMER2A,
+	INT_TIMER3A, INT_TIMER4A, INT_TIMER5A
+};
+
 /*****************************************************************************
  * Bodies of public functions used in soft_timer.c
  *****************************************************************************/
 void _hmcu_init(void){
 
-	/* Initialize all it is needed for hardware MCU.
+	/* Initialize all it is needed for hardware MCU, for the timers of every
+	 * channel, at the same interrupt priority.
 	 * Do not make it repeatable, and in increment order of countdown. */
 }
 
-void _hmcu_enableIRQ(void){
+void _hmcu_enableIRQ(uint8_t channel){
 
-	/* Clear and enable the interrupts related to the timer. */
+	/* Clear and enable the interrupts related to the timer of the
+	 * channel. */
 }
 
-void _hmcu_disableIRQ(void){
+void _hmcu_disableIRQ(uint8_t channel){
 
-	/* Disable the interrupts related to the timer, and clear the interrupts. */
+	/* Disable the interrupts related to the timer of the channel, and clear
+	 * the interrupts. */
 }
 
-void _hmcu_startTimer(void){
+void _hmcu_startTimer(uint8_t channel){
 
-	/* Only start the hardware timer. */
+	/* Only start the hardware timer of the channel. */
+	/* TimerEnable(hw_bases[channel], TIMER_A); */
 }
 
-void _hmcu_stopTimer(void){
+void _hmcu_stopTimer(uint8_t channel){
 
-	/* Only stop the hardware timer. */
+	/* Only stop the hardware timer of the channel. */
+	/* TimerDisable(hw_bases[channel], TIMER_A); */
 }
 
-void _hmcu_setPrescaler(uint16_t prescalerFlag){
+void _hmcu_readCaps(uint8_t channel, hmcu_timer_caps * p_caps){
 
-	/* Set the prescaler of hardware timer MCU. */
+	/* Give the clock of the timer and the ranges of its registers. A
+	 * 16/32-bit timer of the TM4C123 split in 16 bits has an 8-bit
+	 * prescaler. Every channel uses the same kind of timer. */
+	p_caps->clock_hz = 80000000; /* SysCtlClockGet(); */
+	p_caps->prescaler_max = 256;
+	p_caps->counter_bits = 16;
 }
 
-uint16_t _hmcu_readPrescaler(void){
+void _hmcu_setPrescaler(uint8_t channel, uint32_t prescaler){
 
-	/* Read the prescaler of hardware timer MCU. */
+	/* Set the prescaler of hardware timer MCU. The clock is divided by the
+	 * given value, from 1 to prescaler_max, so the register takes the
+	 * value minus one. */
 
-	uint32_t prcValue = 0;
+	/* TimerPrescaleSet(hw_bases[channel], TIMER_A, prescaler - 1); */
+}
 
-	/* prcValue = TimerPrescaleGet(); */
+uint32_t _hmcu_readPrescaler(uint8_t channel){
+
+	/* Read the prescaler of hardware timer MCU, as the division of the
+	 * clock. */
+
+	uint32_t prcValue = 1;
+
+	/* prcValue = TimerPrescaleGet(hw_bases[channel], TIMER_A) + 1; */
 
 	return prcValue;
 }
 
-uint16_t _hmcu_readCountdown(void){
+uint32_t _hmcu_readCountdown(uint8_t channel){
 
-	/* Read the actual countdown value from the register.
-	 * Beware the clock frequency of your MCU, and convert the value to
-	 * milliseconds. */
+	/* Read how many counts elapsed since the countdown was set, in units
+	 * of the prescaler. The timer counts down from the load. */
 
 	uint32_t cdValue = 0;
 
-	/* cdValue = TimerValueGet()/(ClockGet()/1000); */
+	/* cdValue = TimerLoadGet(hw_bases[channel], TIMER_A) -
+	 *           TimerValueGet(hw_bases[channel], TIMER_A); */
 
 	return cdValue;
 }
 
-void _hmcu_setCountdown(uint16_t cdValue){
+void _hmcu_setCountdown(uint8_t channel, uint32_t cdValue){
+
+	/* Set the countdown value at the register, in counts of the
+	 * prescaled clock, and restart the count. */
+
+	TimerLoadSet(hw_bases[channel], TIMER_A, cdValue);
+}
+
+void _hmcu_setPeriodic(uint8_t channel, bool periodic){
+
+	/* Set the timer of the channel to reload the countdown by itself and
+	 * keep counting when it expires, or to stop there. Only used with
+	 * SOFT_TIMER_AUTO_RELOAD. */
+
+	/* TimerConfigure(hw_bases[channel], TIMER_CFG_SPLIT_PAIR |
+	 *                (periodic ? TIMER_CFG_A_PERIODIC :
+	 *                            TIMER_CFG_A_ONE_SHOT)); */
+}
+
+uint64_t _hmcu_readMonotonic(void){
+
+	/* Read a free-running counter, in microseconds since _hmcu_init(). It
+	 * is not stopped by _hmcu_stopTimer(), so it needs another hardware
+	 * timer, not used by any channel, counting up periodically, whose
+	 * overflows are counted to extend it to 64 bits. Only used with
+	 * SOFT_TIMER_MONOTONIC, SOFT_TIMER_STATS or SOFT_TIMER_TRACE. */
+
+	uint64_t usValue = 0;
+
+	/* usValue = (((uint64_t)overflows << 32) + TimerValueGet())/
+	 *           (ClockGet()/1000000); */
+
+	return usValue;
+}
+
+void _hmcu_bindChannel(uint8_t channel){
+
+	/* Route the interrupt of the timer of the channel to the calling core.
+	 * The TM4C123 has a single core, which already takes every interrupt.
+	 * Only used with SOFT_TIMER_SHARDED, by soft_timer_shard_attach(). The
+	 * posted mode does not route the interrupts. */
+}
 
-	/* Set the countdown value at the register.
-	 * Beware the clock frequency of your MCU, and convert the value. */
+uint8_t _hmcu_readContext(void){
 
-	uint32_t loadValue = 0;
+	/* Return the channel routed to the calling core. With a single core it
+	 * is always the channel 0. Only used with SOFT_TIMER_SHARDED, to find
+	 * the shard of the caller. The posted mode tells its callbacks apart by
+	 * the interrupt being handled, without it. */
+
+	return 0;
+}
+
+void _hmcu_triggerIRQ(uint8_t channel){
+
+	/* Set the interrupt of the timer of the channel pending, so it runs as
+	 * soon as it is enabled. Used with SOFT_TIMER_SHARDED or
+	 * SOFT_TIMER_POSTED, to have the interrupt of the channel apply the
+	 * commands posted at its inbox. */
+
+	IntPendSet(hw_ints[channel]);
+}
+
+void _hmcu_idle(uint32_t sleep_us){
+
+	/* Mask every interrupt at the core, so none is lost between enabling
+	 * the ones of the channels and sleeping, and wait for an interrupt. It
+	 * is taken once the core is unmasked again. The timers of the TM4C123
+	 * keep counting in sleep, but not in deep sleep with the PLL off, so
+	 * deep sleep only suits a port whose channels run from the low
+	 * frequency oscillator. Only used by soft_timer_idle(). */
+
+	/* IntMasterDisable();
+	 * for(channel = 0 ; channel < SOFT_TIMER_CHANNELS; channel++){
+	 *     IntEnable(hw_ints[channel]);
+	 * }
+	 * (sleep_us > HMCU_DEEP_SLEEP_US) ? SysCtlDeepSleep() : SysCtlSleep();
+	 * for(channel = 0 ; channel < SOFT_TIMER_CHANNELS; channel++){
+	 *     IntDisable(hw_ints[channel]);
+	 * }
+	 * IntMasterEnable(); */
+	(void)sleep_us;
+}
+
+/*****************************************************************************
+ * Interrupt vectors of the timers of the channels. The handler ignores the
+ * channels not used by the build.
+ *****************************************************************************/
+void Timer0AIntHandler(void){
+
+	soft_timer_channel_irq_handler(0);
+}
+
+void Timer1AIntHandler(void){
+
+	soft_timer_channel_irq_handler(1);
+}
+
+void Timer2AIntHandler(void){
+
+	soft_timer_channel_irq_handler(2);
+}
+
+void Timer3AIntHandler(void){
+
+	soft_timer_channel_irq_handler(3);
+}
+
+void Timer4AIntHandler(void){
+
+	soft_timer_channel_irq_handler(4);
+}
 
-	/* loadValue = (ClockGet()/1000)*cdValue; */
+void Timer5AIntHandler(void){
 
-	TimerLoadSet(loadValue);
+	soft_timer_channel_irq_handler(5);
 }
@@ -8,41 +8,301 @@
 #ifndef SRC_HMCU_TIMER_H_
 #define SRC_HMCU_TIMER_H_
 
+#include <stdint.h>
+#include <stdbool.h>
+
 /*****************************************************************************
  * Public constants.
  *****************************************************************************/
 
+/**
+ * @brief Scalable mode. When set to 1, the pool of instances is not static:
+ * it grows on demand in chunks of SOFT_TIMER_CHUNK_SIZE instances allocated
+ * from the heap, up to SOFT_TIMER_MAX_INSTANCES. Meant for hosts with
+ * hundreds of thousands of timers.
+ */
+#ifndef SOFT_TIMER_SCALABLE
+#define SOFT_TIMER_SCALABLE 0
+#endif
+
+/**
+ * @brief Number of instances allocated at once by the scalable mode.
+ */
+#ifndef SOFT_TIMER_CHUNK_SIZE
+#define SOFT_TIMER_CHUNK_SIZE 1024
+#endif
+
 /**
  * @brief Maximum number of simultaneously allocated software timer instances.
+ * It is the capacity of the pool of instances, and can be set per build.
  */
+#ifndef SOFT_TIMER_MAX_INSTANCES
+#if (SOFT_TIMER_SCALABLE)
+#define SOFT_TIMER_MAX_INSTANCES 1048576
+#else
 #define SOFT_TIMER_MAX_INSTANCES 10
+#endif
+#endif
+
+/**
+ * @brief Compact layout. When set to 1, the flags of every instance are
+ * packed in bits, its free list and heap links share one index, and the heaps
+ * keep 16 bit positions of the pool instead of addresses, so each timer takes
+ * fewer bytes of RAM. Needs the static pool, the heap engine and up to 64
+ * channels.
+ */
+#ifndef SOFT_TIMER_COMPACT
+#define SOFT_TIMER_COMPACT 0
+#endif
 
 /**
  * @brief Maximum timeout value in milliseconds for a software timer.
  */
-#define SOFT_TIMER_MAX_RELOAD_MS 100000000
+#define SOFT_TIMER_MAX_RELOAD_MS 1000000
+
+/**
+ * @brief Maximum timeout value in microseconds for a software timer. Every
+ * time of the queue is kept in microseconds, on 32 bits, so timeouts have
+ * to stay below 2^31 us.
+ */
+#define SOFT_TIMER_MAX_RELOAD_US 1000000000
+
+/**
+ * @brief Scheduler engines selectable through SOFT_TIMER_ENGINE.
+ *
+ * The heap engine keeps the running timers in a binary min-heap, with
+ * O(log n) start and stop. The wheel engine keeps them in a hierarchical
+ * timing wheel, with O(1) start and stop and an expiry cost proportional
+ * to the timers that actually fire.
+ */
+#define SOFT_TIMER_ENGINE_HEAP	0
+#define SOFT_TIMER_ENGINE_WHEEL	1
+
+/**
+ * @brief Scheduler engine used by the software timer.
+ */
+#ifndef SOFT_TIMER_ENGINE
+#define SOFT_TIMER_ENGINE SOFT_TIMER_ENGINE_HEAP
+#endif
+
+/**
+ * @brief Heap keys. When set to 1, every heap keeps the deadlines of its
+ * items in an array of their own, next to the items, so sifting compares
+ * contiguous keys instead of reading every instance it passes by. It costs
+ * 4 bytes per position, and pays off with thousands of timers, so it is on
+ * by default in scalable mode only.
+ */
+#ifndef SOFT_TIMER_HEAP_KEYS
+#define SOFT_TIMER_HEAP_KEYS SOFT_TIMER_SCALABLE
+#endif
+
+/**
+ * @brief Number of levels of the timing wheel. Every level has ten slots,
+ * and the slots of level n are 10^n microseconds wide, so the default
+ * levels have 1 us, 10 us, 100 us, ... granularity and span 10^10 us, more
+ * than the longest timeout. The timers cascade through the levels within
+ * the interrupts set by their deadlines, so more levels cost no interrupt.
+ */
+#ifndef SOFT_TIMER_WHEEL_LEVELS
+#define SOFT_TIMER_WHEEL_LEVELS 10
+#endif
+
+/**
+ * @brief Monotonic time base. When set to 1, the time of the queue is read
+ * from the free-running counter of _hmcu_readMonotonic() instead of being
+ * added up from the countdowns, so starting and stopping timers loses no
+ * time, and repeating timers are reloaded from their previous deadline,
+ * keeping their phase.
+ */
+#ifndef SOFT_TIMER_MONOTONIC
+#define SOFT_TIMER_MONOTONIC 0
+#endif
+
+/**
+ * @brief Deferred dispatch. When set to 1, the interrupt handler does not
+ * run the callbacks: it only pushes the expired timers at a ring, and
+ * soft_timer_dispatch() runs their callbacks from the main loop or a worker
+ * thread, so the interrupt time does not depend on the callbacks.
+ */
+#ifndef SOFT_TIMER_DEFERRED
+#define SOFT_TIMER_DEFERRED 0
+#endif
+
+/**
+ * @brief Number of positions of the dispatch ring, a power of two. Expiries
+ * that find the ring full are lost, and counted.
+ */
+#ifndef SOFT_TIMER_DISPATCH_RING_SIZE
+#if (SOFT_TIMER_SCALABLE)
+#define SOFT_TIMER_DISPATCH_RING_SIZE 4096
+#else
+#define SOFT_TIMER_DISPATCH_RING_SIZE 16
+#endif
+#endif
+
+/**
+ * @brief Number of hardware timers, or channels, used by the software timer.
+ * Every channel has its own queue and interrupt, so an interrupt only serves
+ * the timers of its channel, and starting or stopping a timer only sets the
+ * registers of its channel. The interrupts of every channel have to share
+ * the same priority.
+ */
+#ifndef SOFT_TIMER_CHANNELS
+#define SOFT_TIMER_CHANNELS 1
+#endif
+
+/**
+ * @brief Repeating timers with a period up to this value, in microseconds,
+ * are given the channel 0 when there are several channels. The other timers
+ * are spread over the remaining channels.
+ */
+#ifndef SOFT_TIMER_FAST_PERIOD_US
+#define SOFT_TIMER_FAST_PERIOD_US 10000
+#endif
+
+/**
+ * @brief Hardware auto-reload. When set to 1, a repeating timer alone on the
+ * queue of its channel is left to the periodic mode of the hardware timer,
+ * set by _hmcu_setPeriodic(), so its interrupts only run its callback and
+ * set no register. It needs SOFT_TIMER_MONOTONIC.
+ */
+#ifndef SOFT_TIMER_AUTO_RELOAD
+#define SOFT_TIMER_AUTO_RELOAD 0
+#endif
+
+/**
+ * @brief Sharded mode. When set to 1, every channel is a shard owned by one
+ * thread or core, given by soft_timer_shard_attach(), with its own part of
+ * the pool and its own queue, and nothing is shared between shards. Starts,
+ * stops and new settings of the timers of another shard are handed off to
+ * its inbox, and applied by its interrupt. It needs the atomic builtins of GCC or Clang.
+ */
+#ifndef SOFT_TIMER_SHARDED
+#define SOFT_TIMER_SHARDED 0
+#endif
+
+/**
+ * @brief Posted mode. When set to 1, starting, stopping and setting again a
+ * timer never disables the interrupts nor stops the hardware timer: the
+ * command is posted at the lock-free inbox of the channel of the timer, and
+ * its interrupt applies the pending commands in a single batch. Only the
+ * callbacks of the channel act on its queue right away. It needs the atomic
+ * builtins of GCC or Clang.
+ */
+#ifndef SOFT_TIMER_POSTED
+#define SOFT_TIMER_POSTED 0
+#endif
+
+/**
+ * @brief Number of positions of the inbox of every channel, a power of two.
+ * Commands posted at a full inbox are refused.
+ */
+#ifndef SOFT_TIMER_INBOX_SIZE
+#if (SOFT_TIMER_SCALABLE)
+#define SOFT_TIMER_INBOX_SIZE 4096
+#else
+#define SOFT_TIMER_INBOX_SIZE 16
+#endif
+#endif
+
+/**
+ * @brief Runtime statistics. When set to 1, every timer counts its fires,
+ * how late it fired and how long its callback took, and every channel counts
+ * its interrupts, the time spent in them and the settings of its registers,
+ * read through soft_timer_get_stats() and soft_timer_get_irq_stats(). The
+ * durations are read from _hmcu_readMonotonic().
+ */
+#ifndef SOFT_TIMER_STATS
+#define SOFT_TIMER_STATS 0
+#endif
+
+/**
+ * @brief Number of buckets of the histogram of callback durations. Bucket 0
+ * counts the callbacks under 1 us, bucket n the ones from 2^(n-1) us to
+ * 2^n us, and the last one every longer callback.
+ */
+#ifndef SOFT_TIMER_STATS_BUCKETS
+#define SOFT_TIMER_STATS_BUCKETS 12
+#endif
+
+/**
+ * @brief Event trace. When set to 1, the starts, stops, expiries and
+ * settings of the registers are recorded at a ring of
+ * SOFT_TIMER_TRACE_SIZE fixed-size binary records, stamped with
+ * _hmcu_readMonotonic(), and read with soft_timer_trace_dump(). The oldest
+ * records are overwritten. It needs the atomic builtins of GCC or Clang.
+ */
+#ifndef SOFT_TIMER_TRACE
+#define SOFT_TIMER_TRACE 0
+#endif
+
+/**
+ * @brief Number of records of the trace ring, a power of two.
+ */
+#ifndef SOFT_TIMER_TRACE_SIZE
+#if (SOFT_TIMER_SCALABLE)
+#define SOFT_TIMER_TRACE_SIZE 65536
+#else
+#define SOFT_TIMER_TRACE_SIZE 256
+#endif
+#endif
 
 /*****************************************************************************
  * Public types.
  *****************************************************************************/
 /**
- * @brief
+ * @brief Software timer object owned by the application. It only keeps the
+ * handle of its instance, given by soft_timer_create(), so every call can
+ * reach the instance without searching for it.
  */
 typedef struct soft_timer{
-	uint32_t value;
+	uint32_t handle;
 }soft_timer;
 
+/**
+ * @brief Capabilities of the hardware timer, given by _hmcu_readCaps(). The
+ * counter counts the clock divided by the prescaler, which can be any value
+ * from 1 to prescaler_max. The software timer picks the prescaler and the
+ * countdown from them.
+ */
+typedef struct hmcu_timer_caps{
+	uint32_t clock_hz;		/**< Clock at the input of the prescaler. */
+	uint32_t prescaler_max;	/**< Largest division of the clock. */
+	uint8_t counter_bits;	/**< Width of the countdown register. */
+}hmcu_timer_caps;
+
 /*****************************************************************************
  * Public functions.
  *****************************************************************************/
+/* Every function but _hmcu_init(), _hmcu_readMonotonic() and
+ * _hmcu_readContext() acts on the hardware timer of the given channel, from
+ * 0 to SOFT_TIMER_CHANNELS - 1. _hmcu_init() initializes all of them.
+ * The last three are only used with SOFT_TIMER_SHARDED or SOFT_TIMER_POSTED:
+ * _hmcu_bindChannel() routes the interrupt of the channel to the calling
+ * thread or core, _hmcu_readContext() returns the channel routed to the
+ * calling thread or core, or SOFT_TIMER_CHANNELS if none, and
+ * _hmcu_triggerIRQ() raises the interrupt of the channel by software, as
+ * soon as it is enabled. Raising it again before it runs may run it once.
+ * _hmcu_idle() is only used by soft_timer_idle(). It is called with the
+ * interrupts of the channels disabled, and has to enable them and wait for
+ * an interrupt as a single step, in the deepest sleep state that keeps the
+ * timers running and wakes up within sleep_us, or UINT32_MAX when no timer
+ * is running. It returns with them disabled again. */
 extern void _hmcu_init(void);
-extern void _hmcu_enableIRQ(void);
-extern void _hmcu_disableIRQ(void);
-extern void _hmcu_startTimer(void);
-extern void _hmcu_stopTimer(void);
-extern void _hmcu_setPrescaler(uint16_t prescalerFlag);
-extern uint16_t _hmcu_readPrescaler(void);
-extern uint16_t _hmcu_readCountdown(void);
-extern void _hmcu_setCountdown(uint16_t cdValue);
+extern void _hmcu_enableIRQ(uint8_t channel);
+extern void _hmcu_disableIRQ(uint8_t channel);
+extern void _hmcu_startTimer(uint8_t channel);
+extern void _hmcu_stopTimer(uint8_t channel);
+extern void _hmcu_readCaps(uint8_t channel, hmcu_timer_caps * p_caps);
+extern void _hmcu_setPrescaler(uint8_t channel, uint32_t prescaler);
+extern uint32_t _hmcu_readPrescaler(uint8_t channel);
+extern uint32_t _hmcu_readCountdown(uint8_t channel);
+extern void _hmcu_setCountdown(uint8_t channel, uint32_t cdValue);
+extern void _hmcu_setPeriodic(uint8_t channel, bool periodic);
+extern uint64_t _hmcu_readMonotonic(void);
+extern void _hmcu_bindChannel(uint8_t channel);
+extern uint8_t _hmcu_readContext(void);
+extern void _hmcu_triggerIRQ(uint8_t channel);
+extern void _hmcu_idle(uint32_t sleep_us);
 
 #endif /* SRC_HMCU_TIMER_H_ */
@@ -0,0 +1,326 @@
+/**
+ * @file hmcu_timer_linux.c
+ *
+ * @brief Implementation of hardware layer for software timer on Linux hosts.
+ *
+ * Every channel is emulated by a POSIX timer on CLOCK_MONOTONIC, and its
+ * interrupt by its own real-time signal, from HMCU_LINUX_SIGNAL on, delivered
+ * to the thread that called soft_timer_init(). Disabling the interrupt
+ * blocks the signal, so the software timer functions must be called from
+ * that same thread, like they would be called from the main loop of a MCU.
+ * The handler of any channel blocks every signal of the port, so the
+ * interrupts have a single priority and do not nest.
+ *
+ * With SOFT_TIMER_SHARDED the signal of a channel is delivered instead to
+ * the thread that attached its shard, with soft_timer_shard_attach(). Each
+ * thread then blocks only its own signal, and the shards run in parallel.
+ *
+ * A pending signal is delivered as soon as the interrupt is enabled again,
+ * instead of being cleared. The software timer takes such an interrupt as
+ * an early one and just sets the registers again.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "soft_timer.h"
+#include "hmcu_timer.h"
+
+/*****************************************************************************
+ * Private constants.
+ *****************************************************************************/
+#ifndef HMCU_LINUX_SIGNAL
+#define HMCU_LINUX_SIGNAL (SIGRTMIN)
+#endif
+
+/* The emulated timer counts nanoseconds, on a 32-bit counter. */
+#define HMCU_LINUX_CLOCK_HZ			1000000000u
+#define HMCU_LINUX_COUNTER_BITS		32
+#define HMCU_LINUX_PRESCALER_MAX	65536u
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+/*****************************************************************************
+ * Global variables.
+ *****************************************************************************/
+static timer_t				hw_timer[SOFT_TIMER_CHANNELS];
+static pthread_t			hw_owner[SOFT_TIMER_CHANNELS];
+static sigset_t				hw_irq_set[SOFT_TIMER_CHANNELS];
+static sigset_t				hw_all_set;
+static uint32_t				hw_prescaler[SOFT_TIMER_CHANNELS];
+static uint32_t				hw_load[SOFT_TIMER_CHANNELS];
+static uint64_t				hw_elapsed_ns[SOFT_TIMER_CHANNELS];
+static uint64_t				hw_started_ns[SOFT_TIMER_CHANNELS];
+static uint64_t				hw_init_ns = 0;
+static bool					hw_running[SOFT_TIMER_CHANNELS];
+static bool					hw_periodic[SOFT_TIMER_CHANNELS];
+static volatile uint8_t		hw_triggered[SOFT_TIMER_CHANNELS];
+static __thread volatile sig_atomic_t hw_in_irq = 0;
+static __thread uint8_t		hw_context = SOFT_TIMER_CHANNELS;
+
+/*****************************************************************************
+ * Bodies of private functions.
+ *****************************************************************************/
+
+static uint64_t _hmcu_nanoseconds(void){
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t _hmcu_loadNanoseconds(uint8_t channel){
+
+	/* A count is as many nanoseconds as the prescaler. */
+	return (uint64_t)hw_load[channel]*hw_prescaler[channel];
+}
+
+static uint64_t _hmcu_elapsedNanoseconds(uint8_t channel){
+
+	uint64_t elapsed = hw_elapsed_ns[channel];
+
+	/* Like the one-shot hardware timer, the count stops at the load. The
+	 * periodic one starts again from zero. */
+	if(hw_running[channel]){
+		elapsed += _hmcu_nanoseconds() - hw_started_ns[channel];
+	}
+	if(hw_periodic[channel] && (_hmcu_loadNanoseconds(channel) != 0)){
+		elapsed %= _hmcu_loadNanoseconds(channel);
+	}else if(elapsed > _hmcu_loadNanoseconds(channel)){
+		elapsed = _hmcu_loadNanoseconds(channel);
+	}
+	return elapsed;
+}
+
+static void _hmcu_createTimer(uint8_t channel){
+
+	struct sigevent sev;
+
+	/* Create the POSIX timer of the channel, whose expiry raises its signal
+	 * at the calling thread. */
+	sev.sigev_notify = SIGEV_THREAD_ID;
+	sev.sigev_signo = HMCU_LINUX_SIGNAL + channel;
+	sev.sigev_value.sival_ptr = NULL;
+	sev.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+	if(timer_create(CLOCK_MONOTONIC, &sev, &hw_timer[channel]) != 0){
+		abort();
+	}
+	hw_owner[channel] = pthread_self();
+}
+
+static void _hmcu_signalHandler(int signo){
+
+	/* The kernel blocks the signals of the port while it is handled, and
+	 * restores the mask when the handler returns, so the interrupt does not
+	 * nest. A software trigger is cleared before the handler runs, like a
+	 * pending bit, so a trigger raised meanwhile runs it again. */
+	hw_in_irq = 1;
+	__atomic_store_n(&hw_triggered[signo - HMCU_LINUX_SIGNAL], 0,
+					 __ATOMIC_SEQ_CST);
+	soft_timer_channel_irq_handler((uint8_t)(signo - HMCU_LINUX_SIGNAL));
+	hw_in_irq = 0;
+}
+
+/*****************************************************************************
+ * Bodies of public functions used in soft_timer.c
+ *****************************************************************************/
+void _hmcu_init(void){
+
+	struct sigaction sa;
+	uint8_t channel;
+
+	/* Route the expiry of a monotonic POSIX timer per channel, as a
+	 * real-time signal, to the calling thread. Its handler is the interrupt
+	 * handler of the channel. */
+	sigemptyset(&hw_all_set);
+	for(channel = 0 ; channel < SOFT_TIMER_CHANNELS; channel++){
+		sigemptyset(&hw_irq_set[channel]);
+		sigaddset(&hw_irq_set[channel], HMCU_LINUX_SIGNAL + channel);
+		sigaddset(&hw_all_set, HMCU_LINUX_SIGNAL + channel);
+	}
+
+	for(channel = 0 ; channel < SOFT_TIMER_CHANNELS; channel++){
+
+		sa.sa_handler = _hmcu_signalHandler;
+		sa.sa_mask = hw_all_set;
+		sa.sa_flags = SA_RESTART;
+		sigaction(HMCU_LINUX_SIGNAL + channel, &sa, NULL);
+
+		_hmcu_createTimer(channel);
+		hw_prescaler[channel] = 1;
+		hw_load[channel] = 0;
+		hw_elapsed_ns[channel] = 0;
+		hw_running[channel] = false;
+		hw_periodic[channel] = false;
+	}
+	hw_init_ns = _hmcu_nanoseconds();
+}
+
+void _hmcu_enableIRQ(uint8_t channel){
+
+	/* Unblock the signal, unless inside the handler: there the mask is
+	 * restored when it returns. */
+	if(!hw_in_irq){
+		pthread_sigmask(SIG_UNBLOCK, &hw_irq_set[channel], NULL);
+	}
+}
+
+void _hmcu_disableIRQ(uint8_t channel){
+
+	pthread_sigmask(SIG_BLOCK, &hw_irq_set[channel], NULL);
+}
+
+void _hmcu_startTimer(uint8_t channel){
+
+	struct itimerspec its = {{0, 0}, {0, 0}};
+	uint64_t remaining;
+
+	if(hw_running[channel] || (hw_load[channel] == 0)){
+		return;
+	}
+
+	/* Arm the POSIX timer with what is left of the countdown. If the count
+	 * already reached the load, the interrupt is raised right away. In
+	 * periodic mode the whole countdown is armed again at every expiry. */
+	remaining = _hmcu_loadNanoseconds(channel) - hw_elapsed_ns[channel];
+	if(remaining == 0){
+		remaining = 1;
+	}
+	its.it_value.tv_sec = (time_t)(remaining / 1000000000u);
+	its.it_value.tv_nsec = (long)(remaining % 1000000000u);
+	if(hw_periodic[channel]){
+		its.it_interval.tv_sec =
+				(time_t)(_hmcu_loadNanoseconds(channel) / 1000000000u);
+		its.it_interval.tv_nsec =
+				(long)(_hmcu_loadNanoseconds(channel) % 1000000000u);
+	}
+
+	hw_started_ns[channel] = _hmcu_nanoseconds();
+	hw_running[channel] = true;
+	timer_settime(hw_timer[channel], 0, &its, NULL);
+}
+
+void _hmcu_stopTimer(uint8_t channel){
+
+	struct itimerspec its = {{0, 0}, {0, 0}};
+
+	if(!hw_running[channel]){
+		return;
+	}
+
+	/* Keep the count reached so far and disarm the POSIX timer. */
+	hw_elapsed_ns[channel] = _hmcu_elapsedNanoseconds(channel);
+	hw_running[channel] = false;
+	timer_settime(hw_timer[channel], 0, &its, NULL);
+}
+
+void _hmcu_readCaps(uint8_t channel, hmcu_timer_caps * p_caps){
+
+	(void)channel;
+	p_caps->clock_hz = HMCU_LINUX_CLOCK_HZ;
+	p_caps->prescaler_max = HMCU_LINUX_PRESCALER_MAX;
+	p_caps->counter_bits = HMCU_LINUX_COUNTER_BITS;
+}
+
+void _hmcu_setPrescaler(uint8_t channel, uint32_t prescaler){
+
+	hw_prescaler[channel] = prescaler;
+}
+
+uint32_t _hmcu_readPrescaler(uint8_t channel){
+
+	return hw_prescaler[channel];
+}
+
+uint32_t _hmcu_readCountdown(uint8_t channel){
+
+	/* Return the elapsed count, in units of the prescaler. */
+	return (uint32_t)(_hmcu_elapsedNanoseconds(channel) /
+					  hw_prescaler[channel]);
+}
+
+void _hmcu_setCountdown(uint8_t channel, uint32_t cdValue){
+
+	/* Load the countdown and restart the count from zero. */
+	hw_load[channel] = cdValue;
+	hw_elapsed_ns[channel] = 0;
+	hw_started_ns[channel] = _hmcu_nanoseconds();
+}
+
+void _hmcu_setPeriodic(uint8_t channel, bool periodic){
+
+	hw_periodic[channel] = periodic;
+}
+
+uint64_t _hmcu_readMonotonic(void){
+
+	/* CLOCK_MONOTONIC never stops, like a free-running counter. */
+	return (_hmcu_nanoseconds() - hw_init_ns) / 1000u;
+}
+
+void _hmcu_bindChannel(uint8_t channel){
+
+	bool running = hw_running[channel];
+
+	/* Create the POSIX timer again, to raise the signal at the calling
+	 * thread, and carry on with the count reached so far. */
+	_hmcu_stopTimer(channel);
+	timer_delete(hw_timer[channel]);
+	_hmcu_createTimer(channel);
+	hw_context = channel;
+	if(running){
+		_hmcu_startTimer(channel);
+	}
+}
+
+uint8_t _hmcu_readContext(void){
+
+	/* Inside a handler it is the channel of the signal, since the signal
+	 * is delivered to the thread of its shard. */
+	return hw_context;
+}
+
+void _hmcu_idle(uint32_t sleep_us){
+
+	sigset_t mask;
+#if (!SOFT_TIMER_SHARDED)
+	uint8_t channel;
+#endif
+
+	/* Unblock the signals of the channels of the calling thread and wait
+	 * for one of them as a single step, so a signal raised just before is
+	 * not missed. The kernel chooses how to sleep, so the time left is not
+	 * needed. The mask is restored when a handler returns. */
+	(void)sleep_us;
+	pthread_sigmask(SIG_BLOCK, NULL, &mask);
+#if (SOFT_TIMER_SHARDED)
+	if(hw_context < SOFT_TIMER_CHANNELS){
+		sigdelset(&mask, HMCU_LINUX_SIGNAL + hw_context);
+	}
+#else
+	for(channel = 0 ; channel < SOFT_TIMER_CHANNELS; channel++){
+		sigdelset(&mask, HMCU_LINUX_SIGNAL + channel);
+	}
+#endif
+	sigsuspend(&mask);
+}
+
+void _hmcu_triggerIRQ(uint8_t channel){
+
+	/* Raise the signal at the thread owning the channel. It stays pending
+	 * while that thread has it blocked. Real-time signals are queued one by
+	 * one, so a trigger still pending is not raised again. */
+	if(__atomic_exchange_n(&hw_triggered[channel], 1, __ATOMIC_SEQ_CST) == 0){
+		pthread_kill(hw_owner[channel], HMCU_LINUX_SIGNAL + channel);
+	}
+}
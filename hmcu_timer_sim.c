@@ -0,0 +1,307 @@
+/**
+ * @file hmcu_timer_sim.c
+ *
+ * @brief Implementation of a virtual-time hardware layer for software timer.
+ *
+ * The hardware timer is emulated over a virtual clock that only moves when
+ * hmcu_sim_step() or hmcu_sim_runUntil() is called. Each step jumps the
+ * clock straight to the next expiry of any channel and runs the interrupt
+ * handler of that channel, so a trace of millions of timer events replays
+ * in seconds, with the same results on every run.
+ *
+ * The simulation has a single thread. For SOFT_TIMER_SHARDED its context
+ * is the channel given to the last _hmcu_bindChannel(), or the channel of
+ * the interrupt being run.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "soft_timer.h"
+#include "hmcu_timer.h"
+#include "hmcu_timer_sim.h"
+
+/*****************************************************************************
+ * Global variables.
+ *****************************************************************************/
+static uint64_t				sim_now_us = 0;
+static uint64_t				sim_irq_count = 0;
+static uint64_t				sim_set_count = 0;
+static uint32_t				hw_prescaler[SOFT_TIMER_CHANNELS];
+static uint32_t				hw_load[SOFT_TIMER_CHANNELS];
+static uint64_t				hw_elapsed_us[SOFT_TIMER_CHANNELS];
+static bool					hw_running[SOFT_TIMER_CHANNELS];
+static bool					hw_periodic[SOFT_TIMER_CHANNELS];
+static bool					hw_irq_enabled[SOFT_TIMER_CHANNELS];
+static bool					hw_irq_pending[SOFT_TIMER_CHANNELS];
+static bool					hw_in_irq = false;
+static uint8_t				sim_context = 0;
+
+/*****************************************************************************
+ * Bodies of private functions.
+ *****************************************************************************/
+
+static uint64_t _hmcu_loadMicroseconds(uint8_t channel){
+
+	/* A count is as many microseconds as the prescaler. */
+	return (uint64_t)hw_load[channel]*hw_prescaler[channel];
+}
+
+static void _hmcu_runIRQ(uint8_t channel){
+
+	uint8_t other, context;
+
+	/* Run the interrupt handler, without nesting: every channel has the
+	 * same priority. The interrupts of other channels raised meanwhile are
+	 * run right after, like pending interrupts. */
+	hw_irq_pending[channel] = false;
+	hw_in_irq = true;
+	sim_irq_count++;
+	context = sim_context;
+	sim_context = channel;
+	soft_timer_channel_irq_handler(channel);
+	sim_context = context;
+	hw_in_irq = false;
+
+	for(other = 0 ; other < SOFT_TIMER_CHANNELS; other++){
+		if(hw_irq_pending[other] && hw_irq_enabled[other]){
+			_hmcu_runIRQ(other);
+			break;
+		}
+	}
+}
+
+static int _hmcu_nextChannel(void){
+
+	uint8_t channel;
+	int next = -1;
+	uint64_t expiry, earliest = UINT64_MAX;
+
+	/* Find the running channel that expires first. */
+	for(channel = 0 ; channel < SOFT_TIMER_CHANNELS; channel++){
+		if(hw_running[channel]){
+			expiry = sim_now_us + _hmcu_loadMicroseconds(channel) -
+					 hw_elapsed_us[channel];
+			if(expiry < earliest){
+				earliest = expiry;
+				next = channel;
+			}
+		}
+	}
+	return next;
+}
+
+/*****************************************************************************
+ * Bodies of public functions used in soft_timer.c
+ *****************************************************************************/
+void _hmcu_init(void){
+
+	uint8_t channel;
+
+	sim_now_us = 0;
+	sim_irq_count = 0;
+	sim_set_count = 0;
+	for(channel = 0 ; channel < SOFT_TIMER_CHANNELS; channel++){
+		hw_prescaler[channel] = 1;
+		hw_load[channel] = 0;
+		hw_elapsed_us[channel] = 0;
+		hw_running[channel] = false;
+		hw_periodic[channel] = false;
+		hw_irq_enabled[channel] = false;
+		hw_irq_pending[channel] = false;
+	}
+}
+
+void _hmcu_enableIRQ(uint8_t channel){
+
+	/* An expiry that happened while the interrupt was disabled is run as
+	 * soon as it is enabled, like a pending interrupt. */
+	hw_irq_enabled[channel] = true;
+	if(hw_irq_pending[channel] && !hw_in_irq){
+		_hmcu_runIRQ(channel);
+	}
+}
+
+void _hmcu_disableIRQ(uint8_t channel){
+
+	hw_irq_enabled[channel] = false;
+}
+
+void _hmcu_startTimer(uint8_t channel){
+
+	if(hw_load[channel] != 0){
+		hw_running[channel] = true;
+	}
+}
+
+void _hmcu_stopTimer(uint8_t channel){
+
+	hw_running[channel] = false;
+}
+
+void _hmcu_readCaps(uint8_t channel, hmcu_timer_caps * p_caps){
+
+	(void)channel;
+	p_caps->clock_hz = HMCU_SIM_CLOCK_HZ;
+	p_caps->prescaler_max = HMCU_SIM_PRESCALER_MAX;
+	p_caps->counter_bits = HMCU_SIM_COUNTER_BITS;
+}
+
+void _hmcu_setPrescaler(uint8_t channel, uint32_t prescaler){
+
+	hw_prescaler[channel] = prescaler;
+}
+
+uint32_t _hmcu_readPrescaler(uint8_t channel){
+
+	return hw_prescaler[channel];
+}
+
+uint32_t _hmcu_readCountdown(uint8_t channel){
+
+	/* Return the elapsed count, in units of the prescaler. */
+	return (uint32_t)(hw_elapsed_us[channel] / hw_prescaler[channel]);
+}
+
+void _hmcu_setCountdown(uint8_t channel, uint32_t cdValue){
+
+	/* Load the countdown and restart the count from zero. */
+	sim_set_count++;
+	hw_load[channel] = cdValue;
+	hw_elapsed_us[channel] = 0;
+}
+
+void _hmcu_setPeriodic(uint8_t channel, bool periodic){
+
+	hw_periodic[channel] = periodic;
+}
+
+uint64_t _hmcu_readMonotonic(void){
+
+	/* The virtual clock itself is the free-running counter. */
+	return sim_now_us;
+}
+
+void _hmcu_bindChannel(uint8_t channel){
+
+	sim_context = channel;
+}
+
+uint8_t _hmcu_readContext(void){
+
+	return sim_context;
+}
+
+void _hmcu_triggerIRQ(uint8_t channel){
+
+	/* Run the interrupt now, or as soon as it is enabled. */
+	if(hw_irq_enabled[channel] && !hw_in_irq){
+		_hmcu_runIRQ(channel);
+	}else{
+		hw_irq_pending[channel] = true;
+	}
+}
+
+void _hmcu_idle(uint32_t sleep_us){
+
+	/* Jump the virtual clock to the next expiry. Its interrupt is left
+	 * pending, and runs as soon as it is enabled again. With no timer
+	 * running, nothing would wake it up, so it returns right away. */
+	(void)sleep_us;
+	hmcu_sim_step();
+}
+
+/*****************************************************************************
+ * Bodies of public functions of the simulation.
+ *****************************************************************************/
+uint64_t hmcu_sim_now(void){
+
+	return sim_now_us;
+}
+
+uint64_t hmcu_sim_nextExpiry(void){
+
+	int channel = _hmcu_nextChannel();
+
+	if(channel < 0){
+		return UINT64_MAX;
+	}
+	return sim_now_us + _hmcu_loadMicroseconds((uint8_t)channel) -
+		   hw_elapsed_us[channel];
+}
+
+bool hmcu_sim_step(void){
+
+	int next = _hmcu_nextChannel();
+	uint8_t channel;
+	uint64_t step;
+
+	if(next < 0){
+		return false;
+	}
+
+	/* Jump to the expiry, and count the same time on the other running
+	 * channels. The one-shot count stops at the load, and the periodic one
+	 * starts again from zero. */
+	step = _hmcu_loadMicroseconds((uint8_t)next) - hw_elapsed_us[next];
+	sim_now_us += step;
+	for(channel = 0 ; channel < SOFT_TIMER_CHANNELS; channel++){
+		if(hw_running[channel]){
+			hw_elapsed_us[channel] += step;
+		}
+	}
+	if(hw_periodic[next]){
+		hw_elapsed_us[next] = 0;
+	}else{
+		hw_running[next] = false;
+	}
+
+	if(hw_irq_enabled[next]){
+		_hmcu_runIRQ((uint8_t)next);
+	}else{
+		hw_irq_pending[next] = true;
+	}
+	return true;
+}
+
+void hmcu_sim_runUntil(uint64_t time_us){
+
+	uint8_t channel;
+
+	/* Run the interrupts due up to the given time. */
+	while(hmcu_sim_nextExpiry() <= time_us){
+		hmcu_sim_step();
+	}
+
+	/* Then count the remaining time, on the running timers. */
+	if(time_us > sim_now_us){
+		for(channel = 0 ; channel < SOFT_TIMER_CHANNELS; channel++){
+			if(hw_running[channel]){
+				hw_elapsed_us[channel] += time_us - sim_now_us;
+			}
+		}
+		sim_now_us = time_us;
+	}
+}
+
+uint64_t hmcu_sim_irqCount(void){
+
+	return sim_irq_count;
+}
+
+uint64_t hmcu_sim_setCount(void){
+
+	return sim_set_count;
+}
+
+uint8_t hmcu_sim_pendingIRQs(void){
+
+	uint8_t channel, pending = 0;
+
+	for(channel = 0 ; channel < SOFT_TIMER_CHANNELS; channel++){
+		if(hw_irq_pending[channel] && !hw_irq_enabled[channel]){
+			pending++;
+		}
+	}
+	return pending;
+}
@@ -0,0 +1,90 @@
+/**
+ * @file hmcu_timer_sim.h
+ *
+ * @brief Controls of the virtual-time hardware layer for software timer.
+ *
+ */
+
+#ifndef SRC_HMCU_TIMER_SIM_H_
+#define SRC_HMCU_TIMER_SIM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*****************************************************************************
+ * Public constants.
+ *****************************************************************************/
+/* The emulated timer counts a 1 MHz clock, so a count with the prescaler at
+ * 1 is one microsecond of the virtual clock. Its width and prescaler range
+ * can be set per build, to replay on the counter of a given MCU. */
+#define HMCU_SIM_CLOCK_HZ		1000000
+
+#ifndef HMCU_SIM_COUNTER_BITS
+#define HMCU_SIM_COUNTER_BITS	16
+#endif
+
+#ifndef HMCU_SIM_PRESCALER_MAX
+#define HMCU_SIM_PRESCALER_MAX	256
+#endif
+
+/* Longest countdown of the emulated timer, in microseconds. */
+#define HMCU_SIM_SPAN_US \
+		((((uint64_t)1 << HMCU_SIM_COUNTER_BITS) - 1)*HMCU_SIM_PRESCALER_MAX)
+
+/*****************************************************************************
+ * Public functions.
+ *****************************************************************************/
+
+/**
+ * @brief Read the virtual clock.
+ *
+ * @return Virtual time in microseconds since the start of the simulation.
+ */
+extern uint64_t hmcu_sim_now(void);
+
+/**
+ * @brief Read the virtual time of the next expiry of the hardware timers.
+ *
+ * @return Virtual time in microseconds, or UINT64_MAX if no hardware timer
+ *         is running.
+ */
+extern uint64_t hmcu_sim_nextExpiry(void);
+
+/**
+ * @brief Jump the virtual clock straight to the next expiry of the hardware
+ * timers and run the interrupt handler of its channel.
+ *
+ * @return False if no hardware timer is running, so there is no interrupt
+ *         to jump to.
+ */
+extern bool hmcu_sim_step(void);
+
+/**
+ * @brief Run every interrupt due up to a virtual time, then move the clock
+ * to that time.
+ *
+ * @param time_us Virtual time to stop at, in microseconds.
+ */
+extern void hmcu_sim_runUntil(uint64_t time_us);
+
+/**
+ * @brief Read the number of interrupts run since the start of the
+ * simulation.
+ */
+extern uint64_t hmcu_sim_irqCount(void);
+
+/**
+ * @brief Read the number of countdowns set at the hardware timers since the
+ * start of the simulation.
+ */
+extern uint64_t hmcu_sim_setCount(void);
+
+/**
+ * @brief Read the number of channels whose interrupt was raised while it
+ * was disabled, and is still waiting for it to be enabled. Outside of the
+ * software timer functions it should be zero, or a command posted at the
+ * channel is stuck.
+ */
+extern uint8_t hmcu_sim_pendingIRQs(void);
+
+#endif /* SRC_HMCU_TIMER_SIM_H_ */
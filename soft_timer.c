@@ -14,49 +14,420 @@
 /*****************************************************************************
  * Private types.
  *****************************************************************************/
+/* Smallest unsigned type able to count and index every instance of the
+ * pool. The value SOFT_TIMER_MAX_INSTANCES itself marks the end of the free
+ * list, so it has to fit too. */
+#if (SOFT_TIMER_MAX_INSTANCES <= UINT8_MAX)
+typedef uint8_t st_index_t;
+#elif (SOFT_TIMER_MAX_INSTANCES <= UINT16_MAX)
+typedef uint16_t st_index_t;
+#else
+typedef uint32_t st_index_t;
+#endif
+
 typedef struct tmr_instance{
 	soft_timer_t            * p_timer;
 	soft_timer_callback_t	timeout_cb;
-	uint32_t                reload_ms;
+	uint32_t                reload_us;
+#if (SOFT_TIMER_COMPACT)
+	uint32_t                deadline;
+	uint32_t				postponed;
+	uint16_t				repeat : 1;
+	uint16_t				isSet : 1;
+	uint16_t				inUse : 1;
+	uint16_t				isPostponed : 1;
+	uint16_t				channelFixed : 1;
+	uint16_t				align_shift : 5;
+	uint16_t				channel : 6;
+#else
 	bool                    repeat;
 	bool					isSet;
 	bool					inUse;
-	uint32_t                countdown;
-	struct tmr_instance 	* prev;
-	struct tmr_instance 	* next;
+	bool					isPostponed;
+	uint8_t					align_shift;
+	uint8_t					channel;
+	bool					channelFixed;
+	st_index_t				list_next;
+	uint32_t                deadline;
+	uint32_t				postponed;
+#endif
+#if (SOFT_TIMER_DEFERRED)
+	volatile bool			dispatchPending;
+#endif
+#if (SOFT_TIMER_STATS)
+	uint32_t				stats_fires;
+	uint32_t				stats_expiries;
+	uint64_t				stats_late_sum;
+	uint32_t				stats_late_max;
+	uint32_t				stats_run_max;
+	uint32_t				stats_runs[SOFT_TIMER_STATS_BUCKETS];
+#endif
+#if (SOFT_TIMER_ENGINE == SOFT_TIMER_ENGINE_WHEEL)
+	uint8_t					wheel_level;
+	uint8_t					wheel_slot;
+	struct tmr_instance 	* slot_prev;
+	struct tmr_instance 	* slot_next;
+#elif (SOFT_TIMER_COMPACT)
+	/* A free instance is never at a queue, and an instance at a queue is
+	 * never free, so both indexes share the same position. */
+	union{
+		st_index_t			list_next;
+		st_index_t			heap_index;
+	};
+#else
+	st_index_t				heap_index;
+#endif
 }tmr_instance;
 
-typedef struct tmr_instance_track{
-	struct tmr_instance		* first;
-	struct tmr_instance		* last;
-}tmr_instance_track;
+/* Free list of instances. In sharded mode every shard takes its instances
+ * from a pool of its own, otherwise a single pool serves every channel. */
+typedef struct st_pool{
+	st_index_t				list_capacity;
+	st_index_t				list_items_qty;
+	st_index_t				list_free_head;
+	st_index_t				list_high_water;
+	uint32_t				list_exhausted;
+}st_pool;
+
+#if ((SOFT_TIMER_SHARDED) || (SOFT_TIMER_POSTED))
+/* Command posted at the inbox of a channel, by another shard or, in posted
+ * mode, by any caller. The sequence tells whether the position was written
+ * by a producer or is free again. A new setting carries the parameters of
+ * soft_timer_set_us(), and a new tolerance the shift of its grid. */
+typedef enum st_command_op{
+	ST_COMMAND_START = 0,
+	ST_COMMAND_STOP,
+	ST_COMMAND_RESTART,
+	ST_COMMAND_MODIFY,
+	ST_COMMAND_TOLERANCE
+}st_command_op;
+
+typedef struct st_command{
+	uint32_t				sequence;
+	soft_timer_t			* p_timer;
+	st_command_op			op;
+	soft_timer_callback_t	timeout_cb;
+	uint32_t				reload_us;
+	bool					repeat;
+	uint8_t					align_shift;
+}st_command;
+#endif
+
+/* Queue of one hardware channel. Every channel keeps its own items, time and
+ * registers, so its interrupt only walks and sets its own queue. */
+typedef struct st_channel{
+#if (SOFT_TIMER_ENGINE == SOFT_TIMER_ENGINE_WHEEL)
+	tmr_instance			* wheel_slots[SOFT_TIMER_WHEEL_LEVELS+1][10];
+	uint32_t				wheel_earliest[SOFT_TIMER_WHEEL_LEVELS][10];
+	uint16_t				wheel_occupied[SOFT_TIMER_WHEEL_LEVELS];
+	uint8_t					wheel_digits[SOFT_TIMER_WHEEL_LEVELS];
+#elif (SOFT_TIMER_SCALABLE)
+	tmr_instance			** queue_heap;
+#if (SOFT_TIMER_HEAP_KEYS)
+	uint32_t				* queue_keys;
+#endif
+#else
+#if (SOFT_TIMER_COMPACT)
+	st_index_t				queue_heap[SOFT_TIMER_MAX_INSTANCES];
+#else
+	tmr_instance			* queue_heap[SOFT_TIMER_MAX_INSTANCES];
+#endif
+#if (SOFT_TIMER_HEAP_KEYS)
+	uint32_t				queue_keys[SOFT_TIMER_MAX_INSTANCES];
+#endif
+#endif
+	st_index_t				queue_items_qty;
+	uint32_t				queue_now;
+	uint32_t				queue_base;
+	uint32_t				queue_alarm;
+	hmcu_timer_caps			queue_caps;
+	uint32_t				queue_counter_max;
+#if (!SOFT_TIMER_MONOTONIC)
+	uint32_t				queue_tick_us;
+#endif
+#if (SOFT_TIMER_AUTO_RELOAD)
+	uint32_t				queue_period;
+	bool					queue_periodic;
+#endif
+#if (SOFT_TIMER_DEFERRED)
+	st_index_t				ring_items[SOFT_TIMER_DISPATCH_RING_SIZE];
+	volatile uint32_t		ring_head;
+	volatile uint32_t		ring_tail;
+	uint32_t				ring_lost;
+#endif
+#if ((SOFT_TIMER_SHARDED) || (SOFT_TIMER_POSTED))
+	st_command				inbox_items[SOFT_TIMER_INBOX_SIZE];
+	uint32_t				inbox_head;
+	uint32_t				inbox_tail;
+#endif
+#if (SOFT_TIMER_STATS)
+	uint32_t				stats_irqs;
+	uint64_t				stats_irq_us;
+	uint32_t				stats_irq_max;
+	uint32_t				stats_reprograms;
+#endif
+	uint8_t					hw_channel;
+	bool					irq_handled;
+	bool					queue_batched;
+}st_channel;
+
+/*****************************************************************************
+ * Private macros.
+ *****************************************************************************/
+#if ((SOFT_TIMER_CHANNELS < 1) || (SOFT_TIMER_CHANNELS > UINT8_MAX))
+#error "SOFT_TIMER_CHANNELS has to be from 1 to 255."
+#endif
+
+/* The compact layout indexes the static pool, and links its instances only
+ * through the heap. */
+#if (SOFT_TIMER_COMPACT)
+#if ((SOFT_TIMER_SCALABLE) || (SOFT_TIMER_ENGINE != SOFT_TIMER_ENGINE_HEAP))
+#error "SOFT_TIMER_COMPACT needs the static pool and the heap engine."
+#endif
+#if (SOFT_TIMER_MAX_INSTANCES > UINT16_MAX)
+#error "SOFT_TIMER_COMPACT needs SOFT_TIMER_MAX_INSTANCES up to 65535."
+#endif
+#if (SOFT_TIMER_CHANNELS > 64)
+#error "SOFT_TIMER_COMPACT needs SOFT_TIMER_CHANNELS up to 64."
+#endif
+#if ((!defined(__GNUC__)) && \
+	 ((!defined(__STDC_VERSION__)) || (__STDC_VERSION__ < 201112L)))
+#error "SOFT_TIMER_COMPACT needs anonymous unions."
+#endif
+#endif
+
+/* A periodic hardware timer may reload unnoticed while its interrupt is
+ * disabled, so its count alone can not give the time of the queue. */
+#if ((SOFT_TIMER_AUTO_RELOAD) && (!SOFT_TIMER_MONOTONIC))
+#error "SOFT_TIMER_AUTO_RELOAD needs SOFT_TIMER_MONOTONIC."
+#endif
+
+#if (SOFT_TIMER_DEFERRED)
+#if ((SOFT_TIMER_DISPATCH_RING_SIZE & (SOFT_TIMER_DISPATCH_RING_SIZE - 1)) != 0)
+#error "SOFT_TIMER_DISPATCH_RING_SIZE has to be a power of two."
+#endif
+#endif
+
+#if ((SOFT_TIMER_SHARDED) || (SOFT_TIMER_POSTED))
+#if ((SOFT_TIMER_INBOX_SIZE & (SOFT_TIMER_INBOX_SIZE - 1)) != 0)
+#error "SOFT_TIMER_INBOX_SIZE has to be a power of two."
+#endif
+#if (!defined(__GNUC__))
+#error "SOFT_TIMER_SHARDED and SOFT_TIMER_POSTED need the atomic builtins."
+#endif
+#endif
+
+#if (SOFT_TIMER_TRACE)
+#if ((SOFT_TIMER_TRACE_SIZE & (SOFT_TIMER_TRACE_SIZE - 1)) != 0)
+#error "SOFT_TIMER_TRACE_SIZE has to be a power of two."
+#endif
+#if (!defined(__GNUC__))
+#error "SOFT_TIMER_TRACE needs the atomic builtins."
+#endif
+#endif
+
+/* Accesses shared between contexts without a lock: the interrupt handler,
+ * which produces at the dispatch ring of its channel, and
+ * soft_timer_dispatch(), which consumes it, the callers posting commands at
+ * the inbox of a channel, and in sharded mode the shards, which also take
+ * chunks of the pool.
+ * Each side of the dispatch ring only writes its own index, so ordered loads
+ * and stores are enough there. The producers of an inbox claim their
+ * positions with a compare and swap. */
+#if defined(__GNUC__)
+#define _ST_ATOMIC_LOAD(var)		__atomic_load_n(&(var), __ATOMIC_ACQUIRE)
+#define _ST_ATOMIC_STORE(var, value) __atomic_store_n(&(var), (value), \
+											  __ATOMIC_RELEASE)
+#define _ST_ATOMIC_CAS(var, expected, value) \
+		__atomic_compare_exchange_n(&(var), &(expected), (value), false, \
+									__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#define _ST_ATOMIC_FETCH_ADD(var, value) \
+		__atomic_fetch_add(&(var), (value), __ATOMIC_ACQ_REL)
+#else
+#define _ST_ATOMIC_LOAD(var)		(var)
+#define _ST_ATOMIC_STORE(var, value) ((var) = (value))
+#define _ST_ATOMIC_FETCH_ADD(var, value) (((var) += (value)) - (value))
+#endif
+
+/* Record an event at the trace ring. Without SOFT_TIMER_TRACE nothing is
+ * compiled, not even the arguments. */
+#if (SOFT_TIMER_TRACE)
+#define _ST_TRACE(event, channel, tmr_inst, value) \
+		_st_TRACE_record((event), (channel), (tmr_inst), (value))
+#else
+#define _ST_TRACE(event, channel, tmr_inst, value) ((void)0)
+#endif
+
+/* Item at a position of the heap of a channel, and storage of an item
+ * there. The compact layout keeps the positions of the instances at the
+ * pool instead of their addresses. */
+#if (SOFT_TIMER_COMPACT)
+#define _ST_HEAP_ITEM(ch, index) \
+		(&list_instances[(ch)->queue_heap[(index)]])
+#define _ST_HEAP_STORE(ch, index, tmr_inst) \
+		((ch)->queue_heap[(index)] = (st_index_t)((tmr_inst) - list_instances))
+#else
+#define _ST_HEAP_ITEM(ch, index)	((ch)->queue_heap[(index)])
+#define _ST_HEAP_STORE(ch, index, tmr_inst) \
+		((ch)->queue_heap[(index)] = (tmr_inst))
+#endif
+
+/* Deadline of the item at a position of the heap of a channel. With heap
+ * keys it is read from the array of keys, which follows the heap. */
+#if (SOFT_TIMER_HEAP_KEYS)
+#define _ST_HEAP_KEY(ch, index)		((ch)->queue_keys[(index)])
+#else
+#define _ST_HEAP_KEY(ch, index)		(_ST_HEAP_ITEM(ch, index)->deadline)
+#endif
+
+/* Every shard has a pool of its own. The static pool is split in equal
+ * ranges, one per pool, and the scalable one gives whole chunks to the pool
+ * that needs them. */
+#if (SOFT_TIMER_SHARDED)
+#define _ST_POOLS			SOFT_TIMER_CHANNELS
+#else
+#define _ST_POOLS			1
+#endif
+#define _ST_POOL_SPAN		((SOFT_TIMER_MAX_INSTANCES + _ST_POOLS - 1)/ \
+							 _ST_POOLS)
+#define _ST_CHUNKS			((SOFT_TIMER_MAX_INSTANCES + \
+							  SOFT_TIMER_CHUNK_SIZE - 1)/SOFT_TIMER_CHUNK_SIZE)
 
 /*****************************************************************************
  * Global variables.
  *****************************************************************************/
-static tmr_instance_track	list_head_tail;
-static uint8_t				list_items_qty = 0;
-static tmr_instance			* queue_sorted[SOFT_TIMER_MAX_INSTANCES];
-static uint8_t				queue_items_qty = 0;
-static uint16_t				last_updated_value = 0;
+#if (SOFT_TIMER_SCALABLE)
+static tmr_instance			* list_chunks[_ST_CHUNKS];
+#if (SOFT_TIMER_SHARDED)
+static uint8_t				list_chunk_pool[_ST_CHUNKS];
+#endif
+static uint32_t				list_chunks_qty = 0;
+#else
+static tmr_instance			list_instances[SOFT_TIMER_MAX_INSTANCES];
+#endif
+static st_pool				list_pools[_ST_POOLS];
+static st_channel			queue_channels[SOFT_TIMER_CHANNELS];
+static uint8_t				queue_batch_depth[_ST_POOLS];
+#if (SOFT_TIMER_TRACE)
+static soft_timer_trace_record_t trace_records[SOFT_TIMER_TRACE_SIZE];
+static uint32_t				trace_head = 0;
+#endif
 static bool					soft_timer_initialized = false;
-static bool					soft_timer_irq_handled = false;
 
 /*****************************************************************************
  * Prototypes for private functions.
  *****************************************************************************/
 /* Prototypes related to software time instances list. */
-static void 		_st_LIST_createInstance(soft_timer_t * p_timer);
-static void 		_st_LIST_destroyInstance(soft_timer_t * p_timer);
+static void			_st_LIST_initPool(uint8_t pool);
+static void			_st_LIST_chainRange(st_pool * p_pool, uint32_t first,
+										uint32_t last);
+static uint8_t		_st_LIST_currentPool(void);
+static uint8_t		_st_LIST_poolOf(tmr_instance * tmr_inst);
+static bool			_st_LIST_reserveInstance(uint8_t pool);
+static tmr_instance * _st_LIST_instanceAt(st_index_t index);
+static void 		_st_LIST_createInstance(uint8_t pool,
+											soft_timer_t * p_timer);
+static void 		_st_LIST_destroyInstance(tmr_instance * tmr_inst);
 static tmr_instance * _st_LIST_whereInstance(soft_timer_t * p_timer);
 
 /* Prototypes related to software time instances queue. */
-static void 		_st_QUEUE_addInstance(tmr_instance * tmr_inst);
-static void 		_st_QUEUE_removeInstance(tmr_instance * tmr_inst);
-static void			_st_QUEUE_updateCountdown(void);
-static void			_st_QUEUE_juxtaposeItems(void);
-static void			_st_QUEUE_sortByCountdown(void);
-static void			_st_QUEUE_parserAndSet(void);
+static void			_st_QUEUE_initChannel(st_channel * ch, uint8_t channel);
+static void			_st_QUEUE_serveIRQ(st_channel * ch);
+static void			_st_QUEUE_disableIRQs(void);
+static void			_st_QUEUE_holdTimer(st_channel * ch);
+static void			_st_QUEUE_enableIRQs(void);
+static uint8_t *	_st_QUEUE_batchDepth(void);
+static void			_st_QUEUE_holdChannel(st_channel * ch);
+static void			_st_QUEUE_releaseChannel(st_channel * ch);
+static bool			_st_QUEUE_isHeld(st_channel * ch);
+static uint32_t		_st_QUEUE_nextDeadline(void);
+static uint8_t		_st_QUEUE_pickChannel(tmr_instance * tmr_inst);
+static void			_st_QUEUE_setInstance(tmr_instance * tmr_inst,
+										  soft_timer_callback_t timeout_cb,
+										  uint32_t reload_us, bool repeat);
+static void 		_st_QUEUE_addInstance(st_channel * ch,
+										  tmr_instance * tmr_inst);
+static void 		_st_QUEUE_removeInstance(st_channel * ch,
+											 tmr_instance * tmr_inst);
+static void			_st_QUEUE_restartInstance(st_channel * ch,
+											  tmr_instance * tmr_inst);
+static void			_st_QUEUE_postponeInstance(st_channel * ch,
+											   tmr_instance * tmr_inst);
+static void			_st_QUEUE_moveInstance(st_channel * ch,
+										   tmr_instance * tmr_inst,
+										   uint32_t deadline);
+static tmr_instance * _st_QUEUE_expiredInstance(st_channel * ch);
+static bool			_st_QUEUE_isExpired(st_channel * ch,
+										tmr_instance * tmr_inst);
+static bool			_st_QUEUE_isEarlier(uint32_t time_a, uint32_t time_b);
+static uint32_t		_st_QUEUE_readSlack(st_channel * ch, uint32_t time);
+static uint32_t		_st_QUEUE_deadlineAfter(st_channel * ch,
+											tmr_instance * tmr_inst,
+											uint32_t timeout_us);
+static uint32_t		_st_QUEUE_alignDeadline(tmr_instance * tmr_inst,
+											uint32_t deadline);
+static uint32_t		_st_QUEUE_nextCountdown(st_channel * ch);
+static uint32_t		_st_QUEUE_reloadDeadline(st_channel * ch,
+											 tmr_instance * tmr_inst);
+static uint32_t		_st_QUEUE_readTime(st_channel * ch);
+static uint32_t		_st_QUEUE_countsToMicroseconds(st_channel * ch,
+												   uint32_t counts,
+												   uint32_t prescaler);
+#if (!SOFT_TIMER_MONOTONIC)
+static uint32_t		_st_QUEUE_readElapsed(st_channel * ch);
+#endif
+static void			_st_QUEUE_updateCountdown(st_channel * ch);
+static void			_st_QUEUE_parserAndSet(st_channel * ch);
+#if (SOFT_TIMER_AUTO_RELOAD)
+static tmr_instance * _st_QUEUE_firstInstance(st_channel * ch);
+static bool			_st_QUEUE_isPeriodic(st_channel * ch, uint32_t countdown,
+										 uint64_t clockCounts);
+static bool			_st_QUEUE_keepPeriodic(st_channel * ch);
+static void			_st_QUEUE_stopPeriodic(st_channel * ch);
+#endif
+
+#if (SOFT_TIMER_DEFERRED)
+/* Prototypes related to the dispatch ring. */
+static void			_st_RING_push(st_channel * ch, tmr_instance * tmr_inst);
+#endif
+
+#if (SOFT_TIMER_STATS)
+/* Prototypes related to the runtime statistics. */
+static void			_st_STATS_resetInstance(tmr_instance * tmr_inst);
+static void			_st_STATS_expire(st_channel * ch, tmr_instance * tmr_inst);
+static void			_st_STATS_run(tmr_instance * tmr_inst);
+#endif
+
+#if (SOFT_TIMER_TRACE)
+/* Prototypes related to the event trace. */
+static void			_st_TRACE_record(uint8_t event, uint8_t channel,
+									 tmr_instance * tmr_inst, uint32_t value);
+#endif
+
+#if ((SOFT_TIMER_SHARDED) || (SOFT_TIMER_POSTED))
+/* Prototypes related to the inbox of the channels. */
+static bool			_st_INBOX_isLocal(st_channel * ch);
+static soft_timer_status_t _st_INBOX_push(st_channel * ch,
+										  soft_timer_t * p_timer,
+										  st_command_op op,
+										  const st_command * p_setting);
+static void			_st_INBOX_apply(st_channel * ch);
+#endif
+
+#if (SOFT_TIMER_ENGINE == SOFT_TIMER_ENGINE_WHEEL)
+/* Prototypes related to the timing wheel engine. */
+static void			_st_WHEEL_insert(st_channel * ch, tmr_instance * tmr_inst);
+static void			_st_WHEEL_unlink(st_channel * ch, tmr_instance * tmr_inst);
+static uint32_t		_st_WHEEL_nextEvent(st_channel * ch, uint8_t * p_level,
+										uint8_t * p_slot);
+static void			_st_WHEEL_advance(st_channel * ch, uint32_t elapsed);
+#else
+/* Prototypes related to the heap engine. */
+static void			_st_QUEUE_swapItems(st_channel * ch, st_index_t index_a,
+										st_index_t index_b);
+static void			_st_QUEUE_siftUp(st_channel * ch, st_index_t index);
+static void			_st_QUEUE_siftDown(st_channel * ch, st_index_t index);
+#endif
 
 /*****************************************************************************
  * Bodies of public functions.
@@ -64,41 +435,50 @@ static void			_st_QUEUE_parserAndSet(void);
 
 void soft_timer_init(void){
 
-	uint8_t i;
+	uint8_t channel, pool;
 
 	/* Initialize global variables. */
-	for(i = 0 ; i < SOFT_TIMER_MAX_INSTANCES; i++){
-		queue_sorted[i] = NULL;
+	for(pool = 0 ; pool < _ST_POOLS; pool++){
+		_st_LIST_initPool(pool);
 	}
-	list_head_tail.first = NULL;
-	list_head_tail.last = NULL;
+#if (SOFT_TIMER_TRACE)
+	trace_head = 0;
+#endif
 	soft_timer_initialized = true;
 
-	/* Initialize hardware timer. */
+	/* Initialize hardware timers, then every channel keeps the capabilities
+	 * of its own timer to choose the prescaler and the countdown. */
 	_hmcu_init();
-	_hmcu_setCountdown(0);
-	_hmcu_setPrescaler(1);
-	_hmcu_stopTimer();
-	_hmcu_disableIRQ();
+	for(channel = 0 ; channel < SOFT_TIMER_CHANNELS; channel++){
+		_st_QUEUE_initChannel(&queue_channels[channel], channel);
+	}
+
+#if ((SOFT_TIMER_POSTED) && (!SOFT_TIMER_SHARDED))
+	/* The posted commands are applied by the interrupts, so they are left
+	 * enabled from now on. With shards, each one enables its own when it is
+	 * attached. */
+	_st_QUEUE_enableIRQs();
+#endif
 }
 
 void soft_timer_create(soft_timer_t *p_timer){
 
 	tmr_instance * tmp_ptr;
+	uint8_t pool;
 
 	/* If soft_timer_init() function was not called yet, just return.*/
 	if(!soft_timer_initialized){
 		return;
 	}
 
-	/* If the double pointer is addressing to NULL, just return. */
+	/* If the double pointer is addressing to NULL, just return. In sharded
+	 * mode the instance is taken from the pool of the calling shard, so a
+	 * thread that owns no shard can not create timers. */
 	if(p_timer == NULL){
 		return;
 	}
-
-	/* If the number of already existing instances surpasses the limit,
-	 * just return. */
-	if(list_items_qty >= SOFT_TIMER_MAX_INSTANCES){
+	pool = _st_LIST_currentPool();
+	if(pool >= _ST_POOLS){
 		return;
 	}
 
@@ -109,9 +489,15 @@ void soft_timer_create(soft_timer_t *p_timer){
 
 	if(tmp_ptr == NULL){
 
-		_hmcu_disableIRQ();
-		_st_LIST_createInstance(p_timer);
-		_hmcu_enableIRQ();
+		/* If the number of already existing instances reached the limit,
+		 * count it and just return. */
+		_st_QUEUE_disableIRQs();
+		if(!_st_LIST_reserveInstance(pool)){
+			list_pools[pool].list_exhausted++;
+		}else{
+			_st_LIST_createInstance(pool, p_timer);
+		}
+		_st_QUEUE_enableIRQs();
 	}
 }
 
@@ -120,7 +506,23 @@ soft_timer_status_t soft_timer_set(soft_timer_t          *p_timer,
                                    uint32_t               reload_ms,
                                    bool                   repeat){
 
+	/* The queue counts in microseconds. */
+	if(reload_ms > SOFT_TIMER_MAX_RELOAD_MS){
+		return (soft_timer_initialized) ? SOFT_TIMER_STATUS_INVALID_PARAMETER
+										: SOFT_TIMER_STATUS_INVALID_STATE;
+	}
+	return soft_timer_set_us(p_timer, timeout_cb, reload_ms*1000u, repeat);
+}
+
+soft_timer_status_t soft_timer_set_us(soft_timer_t          *p_timer,
+                                      soft_timer_callback_t  timeout_cb,
+                                      uint32_t               reload_us,
+                                      bool                   repeat){
+
 	tmr_instance * tmp_ptr;
+#if ((SOFT_TIMER_SHARDED) || (SOFT_TIMER_POSTED))
+	st_command setting;
+#endif
 
 	/* If soft_timer_init() function was not called yet, just return.*/
 	if(!soft_timer_initialized){
@@ -141,18 +543,141 @@ soft_timer_status_t soft_timer_set(soft_timer_t          *p_timer,
 	if(timeout_cb == NULL){
 		return SOFT_TIMER_STATUS_INVALID_PARAMETER;
 	}
-	if(reload_ms > 1000000){
+	if(reload_us > SOFT_TIMER_MAX_RELOAD_US){
+		return SOFT_TIMER_STATUS_INVALID_PARAMETER;
+	}
+
+#if ((SOFT_TIMER_SHARDED) || (SOFT_TIMER_POSTED))
+	/* Once set, the instance may be started and read by the interrupt of
+	 * its channel at any time, so the new setting is posted like a start,
+	 * unless the calling context may change the queue of the channel right
+	 * away. An instance never set is on no queue nor inbox yet. */
+	if((tmp_ptr->isSet) &&
+	   (!_st_INBOX_isLocal(&queue_channels[tmp_ptr->channel]))){
+		setting.timeout_cb = timeout_cb;
+		setting.reload_us = reload_us;
+		setting.repeat = repeat;
+		setting.align_shift = 0;
+		return _st_INBOX_push(&queue_channels[tmp_ptr->channel], p_timer,
+							  ST_COMMAND_MODIFY, &setting);
+	}
+#endif
+
+	/* In the compact layout the flags share a word with the ones written by
+	 * the interrupts, so they are written with the interrupts disabled. */
+#if (SOFT_TIMER_COMPACT)
+	_st_QUEUE_disableIRQs();
+#endif
+	_st_QUEUE_setInstance(tmp_ptr, timeout_cb, reload_us, repeat);
+#if (SOFT_TIMER_COMPACT)
+	_st_QUEUE_enableIRQs();
+#endif
+
+	return SOFT_TIMER_STATUS_SUCCESS;
+}
+
+soft_timer_status_t soft_timer_set_tolerance(soft_timer_t *p_timer,
+											 uint32_t tolerance_ms){
+
+	tmr_instance * tmp_ptr;
+	uint8_t shift;
+#if ((SOFT_TIMER_SHARDED) || (SOFT_TIMER_POSTED))
+	st_command setting;
+#endif
+
+	/* If soft_timer_init() function was not called yet, just return.*/
+	if(!soft_timer_initialized){
+		return SOFT_TIMER_STATUS_INVALID_STATE;
+	}
+
+	/* Obtain the address of respective timer instance. If it was not
+	 * created yet, return invalid parameter. */
+	if(p_timer == NULL){
+		return SOFT_TIMER_STATUS_INVALID_PARAMETER;
+	}else{
+		tmp_ptr = _st_LIST_whereInstance(p_timer);
+	}if(tmp_ptr == NULL){
+		return SOFT_TIMER_STATUS_INVALID_PARAMETER;
+	}
+	if(tolerance_ms > SOFT_TIMER_MAX_RELOAD_MS){
+		return SOFT_TIMER_STATUS_INVALID_PARAMETER;
+	}
+
+	/* Keep the largest power of two of microseconds not above the
+	 * tolerance, as a shift. Rounding a deadline up to a multiple of it
+	 * delays it less than the tolerance. */
+	shift = 0;
+	while(((tolerance_ms*1000u) >> shift) > 1){
+		shift++;
+	}
+
+#if ((SOFT_TIMER_SHARDED) || (SOFT_TIMER_POSTED))
+	/* The interrupt of the channel reads the shift at every start and
+	 * reload, so it is posted like a new setting. */
+	if((tmp_ptr->isSet) &&
+	   (!_st_INBOX_isLocal(&queue_channels[tmp_ptr->channel]))){
+		setting.timeout_cb = NULL;
+		setting.reload_us = 0;
+		setting.repeat = false;
+		setting.align_shift = shift;
+		return _st_INBOX_push(&queue_channels[tmp_ptr->channel], p_timer,
+							  ST_COMMAND_TOLERANCE, &setting);
+	}
+#endif
+
+	/* In the compact layout the shift shares a word with the flags written
+	 * by the interrupts. */
+#if (SOFT_TIMER_COMPACT)
+	_st_QUEUE_disableIRQs();
+#endif
+	tmp_ptr->align_shift = shift;
+#if (SOFT_TIMER_COMPACT)
+	_st_QUEUE_enableIRQs();
+#endif
+
+	return SOFT_TIMER_STATUS_SUCCESS;
+}
+
+soft_timer_status_t soft_timer_set_channel(soft_timer_t *p_timer,
+										   uint8_t channel){
+
+	tmr_instance * tmp_ptr;
+
+	/* If soft_timer_init() function was not called yet, just return.*/
+	if(!soft_timer_initialized){
+		return SOFT_TIMER_STATUS_INVALID_STATE;
+	}
+
+	/* Obtain the address of respective timer instance. If it was not
+	 * created yet, or the channel does not exist, return invalid
+	 * parameter. */
+	if(p_timer == NULL){
+		return SOFT_TIMER_STATUS_INVALID_PARAMETER;
+	}else{
+		tmp_ptr = _st_LIST_whereInstance(p_timer);
+	}if(tmp_ptr == NULL){
+		return SOFT_TIMER_STATUS_INVALID_PARAMETER;
+	}
+	if(channel >= SOFT_TIMER_CHANNELS){
 		return SOFT_TIMER_STATUS_INVALID_PARAMETER;
 	}
 
-	/* Attribute respective parameters. */
-	tmp_ptr->p_timer	= p_timer;
-	tmp_ptr->timeout_cb = timeout_cb;
-	tmp_ptr->reload_ms	= reload_ms;
-	tmp_ptr->repeat		= repeat;
-	tmp_ptr->isSet		= true;
-	tmp_ptr->inUse		= false;
-	tmp_ptr->countdown	= reload_ms;
+	/* An instance on the queue belongs to the queue of its channel, so it
+	 * can only be moved while stopped. In sharded mode it belongs to the
+	 * shard that created it, and is never moved. */
+	if(SOFT_TIMER_SHARDED){
+		return SOFT_TIMER_STATUS_INVALID_STATE;
+	}
+	_st_QUEUE_disableIRQs();
+	if(tmp_ptr->inUse){
+		_st_QUEUE_enableIRQs();
+		return SOFT_TIMER_STATUS_INVALID_STATE;
+	}
+
+	/* Keep the channel, and do not pick another one at the next setting. */
+	tmp_ptr->channel = channel;
+	tmp_ptr->channelFixed = true;
+	_st_QUEUE_enableIRQs();
 
 	return SOFT_TIMER_STATUS_SUCCESS;
 }
@@ -160,6 +685,7 @@ soft_timer_status_t soft_timer_set(soft_timer_t          *p_timer,
 soft_timer_status_t soft_timer_start(soft_timer_t *p_timer){
 
 	tmr_instance * tmp_ptr;
+	st_channel * ch;
 
 	/* If soft_timer_init() function was not called yet, just return.*/
 	if(!soft_timer_initialized){
@@ -181,27 +707,35 @@ soft_timer_status_t soft_timer_start(soft_timer_t *p_timer){
     	return SOFT_TIMER_STATUS_INVALID_STATE;
     }
 
-	/* If all the conditions are OK, disable IRQ and stop hardware timer,
-	 * check if the item is already in use on the queue. If yes, return
-	 * invalid state. */
-	_hmcu_disableIRQ();
-	_hmcu_stopTimer();
+#if ((SOFT_TIMER_SHARDED) || (SOFT_TIMER_POSTED))
+	/* Unless the calling context may change the queue of the channel right
+	 * away, the command is posted at the inbox of the channel, and applied
+	 * by its interrupt. */
+	if(!_st_INBOX_isLocal(&queue_channels[tmp_ptr->channel])){
+		return _st_INBOX_push(&queue_channels[tmp_ptr->channel], p_timer,
+							  ST_COMMAND_START, NULL);
+	}
+#endif
+
+	/* If all the conditions are OK, disable IRQs and stop hardware timer of
+	 * the channel of the instance, check if the item is already in use on
+	 * the queue. If yes, return invalid state. */
+	ch = &queue_channels[tmp_ptr->channel];
+	_st_QUEUE_disableIRQs();
+	_st_QUEUE_holdChannel(ch);
 	if(tmp_ptr->inUse){
-		if(!soft_timer_irq_handled){
-			_hmcu_startTimer();
-			_hmcu_enableIRQ();
-		}
+		_st_QUEUE_releaseChannel(ch);
+		_st_QUEUE_enableIRQs();
 		return SOFT_TIMER_STATUS_INVALID_STATE;
 	}
 
 	/* Add the item in the queue of execution. */
-	_st_QUEUE_addInstance(tmp_ptr);
+	_st_QUEUE_addInstance(ch, tmp_ptr);
 
-	/* If the IRQ is not handled, start hardware timer and enable IRQ again. */
-	if(!soft_timer_irq_handled){
-		_hmcu_startTimer();
-		_hmcu_enableIRQ();
-	}
+	/* Start hardware timer and enable IRQs again, unless the IRQ is
+	 * handled or a transaction is open. */
+	_st_QUEUE_releaseChannel(ch);
+	_st_QUEUE_enableIRQs();
 
 	return SOFT_TIMER_STATUS_SUCCESS;
 }
@@ -209,6 +743,7 @@ soft_timer_status_t soft_timer_start(soft_timer_t *p_timer){
 soft_timer_status_t soft_timer_stop(soft_timer_t *p_timer){
 
 	tmr_instance * tmp_ptr;
+	st_channel * ch;
 
 	/* If soft_timer_init() function was not called yet, just return.*/
 	if(!soft_timer_initialized){
@@ -230,356 +765,2269 @@ soft_timer_status_t soft_timer_stop(soft_timer_t *p_timer){
 		return SOFT_TIMER_STATUS_INVALID_STATE;
 	}
 
-	/* If all the conditions are OK, disable IRQ and stop hardware timer,
-	 * check if the item is not in use on the queue. If not, return
-	 * invalid state. */
-	_hmcu_disableIRQ();
-	_hmcu_stopTimer();
+#if ((SOFT_TIMER_SHARDED) || (SOFT_TIMER_POSTED))
+	/* Unless the calling context may change the queue of the channel right
+	 * away, the command is posted at the inbox of the channel, and applied
+	 * by its interrupt. */
+	if(!_st_INBOX_isLocal(&queue_channels[tmp_ptr->channel])){
+		return _st_INBOX_push(&queue_channels[tmp_ptr->channel], p_timer,
+							  ST_COMMAND_STOP, NULL);
+	}
+#endif
+
+	/* If all the conditions are OK, disable IRQs and stop hardware timer of
+	 * the channel of the instance, check if the item is not in use on the
+	 * queue. If not, return invalid state. */
+	ch = &queue_channels[tmp_ptr->channel];
+	_st_QUEUE_disableIRQs();
+	_st_QUEUE_holdChannel(ch);
 	if(!tmp_ptr->inUse){
-		if(!soft_timer_irq_handled){
-			_hmcu_startTimer();
-			_hmcu_enableIRQ();
-		}
+		_st_QUEUE_releaseChannel(ch);
+		_st_QUEUE_enableIRQs();
 		return SOFT_TIMER_STATUS_INVALID_STATE;
 	}
 
 	/* Remove the item from the queue of execution. */
-	_st_QUEUE_removeInstance(tmp_ptr);
+	_ST_TRACE(SOFT_TIMER_TRACE_STOP, ch->hw_channel, tmp_ptr,
+			  tmp_ptr->deadline);
+	_st_QUEUE_removeInstance(ch, tmp_ptr);
 
-	/* If the IRQ is not handled, start hardware timer and enable IRQ again. */
-	if(!soft_timer_irq_handled){
-		_hmcu_startTimer();
-		_hmcu_enableIRQ();
-	}
+	/* Start hardware timer and enable IRQs again, unless the IRQ is
+	 * handled or a transaction is open. */
+	_st_QUEUE_releaseChannel(ch);
+	_st_QUEUE_enableIRQs();
 
 	return SOFT_TIMER_STATUS_SUCCESS;
 }
 
-void soft_timer_destroy(soft_timer_t *p_timer){
-	
+soft_timer_status_t soft_timer_restart(soft_timer_t *p_timer){
+
 	tmr_instance * tmp_ptr;
+	st_channel * ch;
 
 	/* If soft_timer_init() function was not called yet, just return.*/
 	if(!soft_timer_initialized){
-		return;
+		return SOFT_TIMER_STATUS_INVALID_STATE;
 	}
 
-	/* If the double pointer is addressing to NULL, just return. */
+	/* Obtain the address of respective timer instance. If it was not
+	 * created yet, return invalid parameter. */
 	if(p_timer == NULL){
-		return;
+		return SOFT_TIMER_STATUS_INVALID_PARAMETER;
+	}else{
+		tmp_ptr = _st_LIST_whereInstance(p_timer);
+	}if(tmp_ptr == NULL){
+		return SOFT_TIMER_STATUS_INVALID_PARAMETER;
 	}
 
-	/* Obtain the address of respective timer instance. If it exists
-	 * and is not in use (is not on queue of execution), run the
-	 * conditional to destroy it. */
-	tmp_ptr = _st_LIST_whereInstance(p_timer);
+	/* If the instance was not set yet, return invalid state. */
+	if(!tmp_ptr->isSet){
+		return SOFT_TIMER_STATUS_INVALID_STATE;
+	}
 
-	if((tmp_ptr != NULL) && (!tmp_ptr->inUse)){
+#if ((SOFT_TIMER_SHARDED) || (SOFT_TIMER_POSTED))
+	/* Like the start, the restart may have to be posted. */
+	if(!_st_INBOX_isLocal(&queue_channels[tmp_ptr->channel])){
+		return _st_INBOX_push(&queue_channels[tmp_ptr->channel], p_timer,
+							  ST_COMMAND_RESTART, NULL);
+	}
+#endif
 
-		_hmcu_disableIRQ();
-		_st_LIST_destroyInstance(p_timer);
-		_hmcu_enableIRQ();
+	/* A stopped timer is just started. A running one is restarted, which
+	 * in the usual case, a deadline pushed later, only keeps the new
+	 * deadline, without stopping the hardware timer. */
+	ch = &queue_channels[tmp_ptr->channel];
+	_st_QUEUE_disableIRQs();
+	if(tmp_ptr->inUse){
+		_st_QUEUE_restartInstance(ch, tmp_ptr);
+	}else{
+		_st_QUEUE_holdChannel(ch);
+		_st_QUEUE_addInstance(ch, tmp_ptr);
+		_st_QUEUE_releaseChannel(ch);
 	}
+	_st_QUEUE_enableIRQs();
+
+	return SOFT_TIMER_STATUS_SUCCESS;
 }
 
-void soft_timer_irq_handler(void){
+soft_timer_status_t soft_timer_start_many(soft_timer_t * const *pp_timers,
+										  uint32_t count){
 
-	/* Atribute true to IRQ handled and disable it and stop the hardware
-	 * timer. */
-	soft_timer_irq_handled = true;
-	_hmcu_disableIRQ();
-	_hmcu_stopTimer();
+	soft_timer_status_t status, result;
+	uint32_t i;
 
-	/* Update the countdown of all items on the queue, and execute the
-	 * callback function. */
-	_st_QUEUE_updateCountdown();
-	queue_sorted[0]->timeout_cb(queue_sorted[0]->p_timer);
+	if((pp_timers == NULL) && (count != 0)){
+		return SOFT_TIMER_STATUS_INVALID_PARAMETER;
+	}
 
-	/* Check if the first item's countdown reached to zero. If yes, but
-	 * is set to repeat, reload the value and sort the queue. If yes
-	 * but is not set to repeat, remove it from the queue and juxtapose
-	 * the items. If there is no more items on the queue, just return. */
-	if(queue_sorted[0]->countdown == 0){
+	/* Start every timer inside a single transaction, so the interrupts are
+	 * disabled once and every channel is set once. The first failure is
+	 * returned, but the other timers are still started. */
+	result = soft_timer_begin();
+	if(result != SOFT_TIMER_STATUS_SUCCESS){
+		return result;
+	}
+	for(i = 0 ; i < count; i++){
+		status = soft_timer_start(pp_timers[i]);
+		if((status != SOFT_TIMER_STATUS_SUCCESS) &&
+		   (result == SOFT_TIMER_STATUS_SUCCESS)){
+			result = status;
+		}
+	}
+	soft_timer_commit();
 
-		if(queue_sorted[0]->repeat){
+	return result;
+}
 
-			queue_sorted[0]->countdown = queue_sorted[0]->reload_ms;
-			_st_QUEUE_sortByCountdown();
+soft_timer_status_t soft_timer_stop_many(soft_timer_t * const *pp_timers,
+										 uint32_t count){
 
-		}else{
+	soft_timer_status_t status, result;
+	uint32_t i;
 
-			_st_QUEUE_removeInstance(queue_sorted[0]);
+	if((pp_timers == NULL) && (count != 0)){
+		return SOFT_TIMER_STATUS_INVALID_PARAMETER;
+	}
 
-			if(queue_items_qty == 0){
+	/* Stop every timer inside a single transaction, like
+	 * soft_timer_start_many(). */
+	result = soft_timer_begin();
+	if(result != SOFT_TIMER_STATUS_SUCCESS){
+		return result;
+	}
+	for(i = 0 ; i < count; i++){
+		status = soft_timer_stop(pp_timers[i]);
+		if((status != SOFT_TIMER_STATUS_SUCCESS) &&
+		   (result == SOFT_TIMER_STATUS_SUCCESS)){
+			result = status;
+		}
+	}
+	soft_timer_commit();
 
-				soft_timer_irq_handled = false;
-				return;
+	return result;
+}
 
-			}else{
+soft_timer_status_t soft_timer_begin(void){
 
-				_st_QUEUE_juxtaposeItems();
+	uint8_t * depth;
 
-			}
-		}
+	/* If soft_timer_init() function was not called yet, return invalid
+	 * state. A context without a shard only posts its commands, so it has
+	 * no transaction of its own, and neither has a transaction nested too
+	 * deep. */
+	if(!soft_timer_initialized){
+		return SOFT_TIMER_STATUS_INVALID_STATE;
+	}
+	depth = _st_QUEUE_batchDepth();
+	if((depth == NULL) || (*depth == UINT8_MAX)){
+		return SOFT_TIMER_STATUS_INVALID_STATE;
+	}
+
+	/* Disable the IRQs until the outermost transaction is committed. The
+	 * channels are held as the transaction reaches them. In posted mode
+	 * the starts and stops are posted anyway, and applied in a single batch
+	 * by the interrupt, so nothing is disabled. */
+#if (!SOFT_TIMER_POSTED)
+	if(*depth == 0){
+		_st_QUEUE_disableIRQs();
 	}
+#endif
+	(*depth)++;
 
-	/* If there is item on queue, set the registers and start it. */
-	_st_QUEUE_parserAndSet();
-	_hmcu_startTimer();
-	_hmcu_enableIRQ();
-	soft_timer_irq_handled = false;
+	return SOFT_TIMER_STATUS_SUCCESS;
 }
 
-/*****************************************************************************
- * Bodies of private functions.
- *****************************************************************************/
+soft_timer_status_t soft_timer_commit(void){
 
-static void _st_LIST_createInstance(soft_timer_t * p_timer){
+	uint8_t * depth;
+	uint8_t channel;
+	st_channel * ch;
 
-	/* Create a temporary variable and allocate its location by size of
-	 * tmr_instance struct. */
-	tmr_instance * tmp_ptr;
-	tmp_ptr = malloc(sizeof(tmr_instance));
+	/* Return invalid state if there is no transaction open, and do nothing
+	 * else but closing a nested one. */
+	depth = _st_QUEUE_batchDepth();
+	if((depth == NULL) || (*depth == 0)){
+		return SOFT_TIMER_STATUS_INVALID_STATE;
+	}
+	(*depth)--;
+	if(*depth != 0){
+		return SOFT_TIMER_STATUS_SUCCESS;
+	}
 
-	/* Set some parameters of registering instance. Add by one the
-	 * number of existing instances. */
-	tmp_ptr->p_timer = p_timer;
-	tmp_ptr->isSet = false;
-	list_items_qty++;
-
-	/* The next pointer in the linked list is a NULL value to be
-	 * aware that it is the last item. */
-	tmp_ptr->next = NULL;
-
-	/* If it is the first item, attribute NULL to previous pointer and
-	 * set the list_head_tail's pointer. If it is not, set the included
-	 * item's previous pointer to the next-to-last item, and its next
-	 * pointer. */
-	if(list_items_qty == 1){
-		tmp_ptr->prev = NULL;
-		list_head_tail.first = tmp_ptr;
-	}else{
-		tmp_ptr->prev = list_head_tail.last;
-		list_head_tail.last->next = tmp_ptr;
+	/* Set the registers of every channel held by the transaction once,
+	 * from the time of now, and start its hardware timer again. In sharded
+	 * mode the transaction only held the channel of its own shard. */
+	for(channel = 0 ; channel < SOFT_TIMER_CHANNELS; channel++){
+		ch = &queue_channels[channel];
+		if(!ch->queue_batched){
+			continue;
+		}
+		ch->queue_batched = false;
+		if(ch->queue_items_qty != 0){
+			_st_QUEUE_updateCountdown(ch);
+			_st_QUEUE_parserAndSet(ch);
+		}
+#if (SOFT_TIMER_AUTO_RELOAD)
+		else{
+			_st_QUEUE_stopPeriodic(ch);
+		}
+#endif
+		_hmcu_startTimer(ch->hw_channel);
 	}
+#if (!SOFT_TIMER_POSTED)
+	_st_QUEUE_enableIRQs();
+#endif
 
-	/* Set the list_head_tail pointer to the included item. */
-	list_head_tail.last = tmp_ptr;
+	return SOFT_TIMER_STATUS_SUCCESS;
 }
 
-static void _st_LIST_destroyInstance(soft_timer_t * p_timer){
+void soft_timer_destroy(soft_timer_t *p_timer){
 	
-	/* Create a temporary pointer and run through the items, to find p_timer
-	 * instance. If reached to last item without finding it, just exit. */
-	tmr_instance *tmp_ptr;
-	tmp_ptr = list_head_tail.first;
+	tmr_instance * tmp_ptr;
+#if ((SOFT_TIMER_SHARDED) || (SOFT_TIMER_POSTED))
+	st_channel * ch;
+#endif
 
-	while(tmp_ptr->p_timer != p_timer){
-		if(tmp_ptr->next == NULL){
-			return;
-		}
-		tmp_ptr = tmp_ptr->next;
+	/* If soft_timer_init() function was not called yet, just return.*/
+	if(!soft_timer_initialized){
+		return;
+	}
+
+	/* If the double pointer is addressing to NULL, just return. */
+	if(p_timer == NULL){
+		return;
 	}
 
-	/* If found the instance but it is the only item, just set the
-	 * pointers of list_head_tail. */
-	if((tmp_ptr->prev == NULL) && (tmp_ptr->next == NULL)){
-		list_head_tail.first = NULL;
-		list_head_tail.last = NULL;
+	/* Obtain the address of respective timer instance. If it exists
+	 * and is not in use (is not on queue of execution), run the
+	 * conditional to destroy it. In sharded mode only its own shard can
+	 * give it back to its pool. */
+	tmp_ptr = _st_LIST_whereInstance(p_timer);
+
+	if((tmp_ptr != NULL) &&
+	   (_st_LIST_poolOf(tmp_ptr) == _st_LIST_currentPool())){
+
+		_st_QUEUE_disableIRQs();
+#if ((SOFT_TIMER_SHARDED) || (SOFT_TIMER_POSTED))
+		/* Apply first the commands still waiting at the inbox of its
+		 * channel, so a stop just posted is taken into account. */
+		ch = &queue_channels[tmp_ptr->channel];
+		_st_QUEUE_holdChannel(ch);
+		_st_INBOX_apply(ch);
+		_st_QUEUE_releaseChannel(ch);
+#endif
+		if(!tmp_ptr->inUse){
+			_st_LIST_destroyInstance(tmp_ptr);
+		}
+		_st_QUEUE_enableIRQs();
 	}
+}
+
+void soft_timer_get_pool_stats(soft_timer_pool_stats_t *p_stats){
+
+	uint32_t capacity = 0;
+	uint8_t pool;
+#if (SOFT_TIMER_DEFERRED)
+	uint8_t channel;
+#endif
 
-	/* If found the instance but it is the first item, set the
-	 * list_head_tail pointer and the next item's pointer. */
-	else if((tmp_ptr->prev == NULL) && (tmp_ptr->next != NULL)){
-		list_head_tail.first = tmp_ptr->next;
-		tmp_ptr->next->prev = NULL;
+	/* If the pointer is addressing to NULL, just return. */
+	if(p_stats == NULL){
+		return;
 	}
 
-	/* If found the instance but it is the last item, set the
-	 * list_head_tail pointer and the previous item's pointer. */
-	else if((tmp_ptr->prev != NULL) && (tmp_ptr->next == NULL)){
-		list_head_tail.last = tmp_ptr->prev;
-		tmp_ptr->prev->next = NULL;
+	/* Take a consistent copy of the counters, added up over the pools. In
+	 * sharded mode the pools of the other shards keep changing meanwhile, so
+	 * their part is only a recent sample, and the high water is the sum of
+	 * the high waters of the pools. */
+	_st_QUEUE_disableIRQs();
+	p_stats->capacity	= SOFT_TIMER_MAX_INSTANCES;
+	p_stats->in_use		= 0;
+	p_stats->high_water	= 0;
+	p_stats->exhausted	= 0;
+	for(pool = 0 ; pool < _ST_POOLS; pool++){
+		p_stats->in_use		+= list_pools[pool].list_items_qty;
+		p_stats->high_water	+= list_pools[pool].list_high_water;
+		p_stats->exhausted	+= list_pools[pool].list_exhausted;
+		capacity			+= list_pools[pool].list_capacity;
+	}
+	p_stats->dispatch_lost = 0;
+#if (SOFT_TIMER_DEFERRED)
+	for(channel = 0 ; channel < SOFT_TIMER_CHANNELS; channel++){
+		p_stats->dispatch_lost += queue_channels[channel].ring_lost;
 	}
+#endif
+#if (SOFT_TIMER_SCALABLE)
+	p_stats->bytes		= sizeof(list_chunks) + capacity*sizeof(tmr_instance);
+#if (SOFT_TIMER_SHARDED)
+	p_stats->bytes		+= sizeof(list_chunk_pool);
+#endif
+#else
+	(void)capacity;
+	p_stats->bytes		= sizeof(list_instances);
+#endif
+	p_stats->bytes		+= sizeof(list_pools) + sizeof(queue_channels);
+#if ((SOFT_TIMER_ENGINE != SOFT_TIMER_ENGINE_WHEEL) && (SOFT_TIMER_SCALABLE))
+	/* Without shards the heap of every channel may hold every instance. */
+	p_stats->bytes		+= capacity*sizeof(tmr_instance *)*
+						   (SOFT_TIMER_CHANNELS / _ST_POOLS);
+#if (SOFT_TIMER_HEAP_KEYS)
+	p_stats->bytes		+= capacity*sizeof(uint32_t)*
+						   (SOFT_TIMER_CHANNELS / _ST_POOLS);
+#endif
+#endif
+	_st_QUEUE_enableIRQs();
+}
+
+uint32_t soft_timer_next_deadline(void){
 
-	/* If found the instance in the middle of list, set the both next and
-	 * previous item pointers. */
-	else{
-		tmp_ptr->prev->next = tmp_ptr->next;
-		tmp_ptr->next->prev = tmp_ptr->prev;
+	uint32_t sleep_us;
+
+	/* If soft_timer_init() function was not called yet, no timer runs. */
+	if(!soft_timer_initialized){
+		return UINT32_MAX;
 	}
 
-	/* Finally, deallocate the referent address and decrement the number
-	 * of existing items. */
-	free(tmp_ptr);
-	list_items_qty--;
+	/* Only read the queues, with the interrupts disabled, so the hardware
+	 * timers keep counting. */
+	_st_QUEUE_disableIRQs();
+	sleep_us = _st_QUEUE_nextDeadline();
+	_st_QUEUE_enableIRQs();
+
+	return sleep_us;
 }
 
-static tmr_instance * _st_LIST_whereInstance(soft_timer_t * p_timer){
+void soft_timer_idle(void){
 
-	/* Create a temporary pointer and run through the items, to find
-	 * p_timer instance. If reached to last item without finding it,
-	 * or there is no items on the list, return NULL. This pointer
-	 * is static to avoid segmentation fault problems.*/
-	static tmr_instance * tmp_ptr;
-	tmp_ptr = list_head_tail.first;
+	uint32_t sleep_us;
 
-	while(tmp_ptr->p_timer != p_timer){
-		if((tmp_ptr->next == NULL)||(tmp_ptr == NULL)){
-			return NULL;
-		}
-		tmp_ptr = tmp_ptr->next;
+	/* If soft_timer_init() function was not called yet, just return.*/
+	if(!soft_timer_initialized){
+		return;
 	}
 
-	/* If found, return it's address. */
-	return tmp_ptr;
+	/* Read the time left with the interrupts disabled, and let the port
+	 * enable them and sleep as a single step, so an interrupt coming in
+	 * between still wakes it up. If there is work left already, do not
+	 * sleep at all. */
+	_st_QUEUE_disableIRQs();
+	sleep_us = _st_QUEUE_nextDeadline();
+	if(sleep_us != 0){
+		_hmcu_idle(sleep_us);
+	}
+	_st_QUEUE_enableIRQs();
 }
 
-static void _st_QUEUE_addInstance(tmr_instance * tmr_inst){
+#if (SOFT_TIMER_STATS)
+soft_timer_status_t soft_timer_get_stats(soft_timer_t *p_timer,
+										 soft_timer_stats_t *p_stats){
+
+	tmr_instance * tmp_ptr;
+	uint8_t bucket;
 
-	/* Update the countdown values of every item in the queue. */
-	if(!soft_timer_irq_handled){
-		_st_QUEUE_updateCountdown();
+	/* If soft_timer_init() function was not called yet, just return.*/
+	if(!soft_timer_initialized){
+		return SOFT_TIMER_STATUS_INVALID_STATE;
 	}
 
-	/* Attribute the address, set that it is used at queue, and update the
-	 * countdown value, if it was used before. */
-	queue_sorted[queue_items_qty] = tmr_inst;
-	queue_sorted[queue_items_qty]->inUse = true;
-	queue_sorted[queue_items_qty]->countdown =
-				queue_sorted[queue_items_qty]->reload_ms;
+	/* Obtain the address of respective timer instance. If it was not
+	 * created yet, return invalid parameter. */
+	if((p_timer == NULL) || (p_stats == NULL)){
+		return SOFT_TIMER_STATUS_INVALID_PARAMETER;
+	}else{
+		tmp_ptr = _st_LIST_whereInstance(p_timer);
+	}if(tmp_ptr == NULL){
+		return SOFT_TIMER_STATUS_INVALID_PARAMETER;
+	}
 
-	/* Increment the number of existing items at the queue. */
-	queue_items_qty++;
+	/* Take a consistent copy of the counters. In sharded mode a timer of
+	 * another shard keeps counting meanwhile, so it is only a recent
+	 * sample. */
+	_st_QUEUE_disableIRQs();
+	p_stats->fires			= tmp_ptr->stats_fires;
+	p_stats->late_max_us	= tmp_ptr->stats_late_max;
+	p_stats->late_mean_us	= (tmp_ptr->stats_expiries != 0) ?
+			(uint32_t)(tmp_ptr->stats_late_sum/tmp_ptr->stats_expiries) : 0;
+	p_stats->run_max_us		= tmp_ptr->stats_run_max;
+	for(bucket = 0 ; bucket < SOFT_TIMER_STATS_BUCKETS; bucket++){
+		p_stats->run_hist[bucket] = tmp_ptr->stats_runs[bucket];
+	}
+	_st_QUEUE_enableIRQs();
 
-	/* Organize the queue order, set the registers and start the hardware
-	 * timer. */
-	_st_QUEUE_sortByCountdown();
-	_st_QUEUE_parserAndSet();
+	return SOFT_TIMER_STATUS_SUCCESS;
 }
 
-static void _st_QUEUE_removeInstance(tmr_instance *tmr_inst){
+void soft_timer_get_irq_stats(soft_timer_irq_stats_t *p_stats){
+
+	st_channel * ch;
+	uint8_t channel;
 
-	uint8_t index = 0;
+	/* If the pointer is addressing to NULL, just return. */
+	if(p_stats == NULL){
+		return;
+	}
 
-	/* Find the index of the referent timer instance in the queue. */
-	while(queue_sorted[index] != tmr_inst){
-		index++;
+	/* Add up the counters of every channel, like the ones of the pools. */
+	_st_QUEUE_disableIRQs();
+	p_stats->irqs		= 0;
+	p_stats->irq_us		= 0;
+	p_stats->irq_max_us	= 0;
+	p_stats->reprograms	= 0;
+	for(channel = 0 ; channel < SOFT_TIMER_CHANNELS; channel++){
+		ch = &queue_channels[channel];
+		p_stats->irqs		+= ch->stats_irqs;
+		p_stats->irq_us		+= ch->stats_irq_us;
+		p_stats->reprograms	+= ch->stats_reprograms;
+		if(ch->stats_irq_max > p_stats->irq_max_us){
+			p_stats->irq_max_us = ch->stats_irq_max;
+		}
 	}
+	_st_QUEUE_enableIRQs();
+}
+#endif
 
-	/* Attribute false to indicate that it is no more at the queue,
-	 * and attribute its address to NULL. */
-	queue_sorted[index]->inUse = false;
-	queue_sorted[index] = NULL;
+#if (SOFT_TIMER_TRACE)
+uint32_t soft_timer_trace_dump(soft_timer_trace_record_t *p_records,
+							   uint32_t count){
 
-	/* Decrement the number of items on the queue and juxtapose its items. */
-	queue_items_qty--;
-	_st_QUEUE_juxtaposeItems();
+	uint32_t head, first, i;
+
+	/* If the pointer is addressing to NULL, just return. */
+	if(p_records == NULL){
+		return 0;
+	}
 
-	/* If it was the first element to be deleted, so adjust the
-	 * countdown values and set the registers. */
-	if(index == 0){
-		_st_QUEUE_updateCountdown();
-		_st_QUEUE_parserAndSet();
+	/* Copy the last records written, up to the size of the ring and of the
+	 * array. The interrupts are disabled meanwhile, so the callers of this
+	 * context do not overwrite the records being copied. */
+	_st_QUEUE_disableIRQs();
+	head = _ST_ATOMIC_LOAD(trace_head);
+	first = (head > SOFT_TIMER_TRACE_SIZE) ? head - SOFT_TIMER_TRACE_SIZE : 0;
+	if(head - first > count){
+		first = head - count;
 	}
+	for(i = first ; i != head; i++){
+		p_records[i - first] = trace_records[i & (SOFT_TIMER_TRACE_SIZE - 1)];
+	}
+	_st_QUEUE_enableIRQs();
+
+	return head - first;
 }
+#endif
+
+#if (SOFT_TIMER_DEFERRED)
+uint32_t soft_timer_dispatch(void){
+
+	tmr_instance * tmr_inst;
+	st_channel * ch;
+	uint32_t tail, count = 0;
+	uint8_t channel;
+
+	/* If soft_timer_init() function was not called yet, just return.*/
+	if(!soft_timer_initialized){
+		return 0;
+	}
 
-static void	_st_QUEUE_updateCountdown(void){
+	/* Take the items pushed by the interrupt handlers, in order for each
+	 * channel. The position is released before the callback runs, so the
+	 * handler can push again meanwhile. An item destroyed after its expiry
+	 * is no more pending, and is skipped. In sharded mode every shard only
+	 * dispatches its own ring. */
+	for(channel = 0 ; channel < SOFT_TIMER_CHANNELS; channel++){
 
-	uint8_t i;
-	uint16_t cdValue, prescalerConstant, prescalerFlag;
+#if (SOFT_TIMER_SHARDED)
+		if(channel != _hmcu_readContext()){
+			continue;
+		}
+#endif
+		ch = &queue_channels[channel];
+		tail = ch->ring_tail;
+		while(tail != _ST_ATOMIC_LOAD(ch->ring_head)){
+
+			tmr_inst = _st_LIST_instanceAt(
+				ch->ring_items[tail & (SOFT_TIMER_DISPATCH_RING_SIZE - 1)]);
+			tail++;
+			_ST_ATOMIC_STORE(ch->ring_tail, tail);
+
+			if(_ST_ATOMIC_LOAD(tmr_inst->dispatchPending)){
+				_ST_ATOMIC_STORE(tmr_inst->dispatchPending, false);
+#if (SOFT_TIMER_STATS)
+				_st_STATS_run(tmr_inst);
+#else
+				tmr_inst->timeout_cb(tmr_inst->p_timer);
+#endif
+				count++;
+			}
+		}
+	}
 
-	/* Check the current prescaler to atribute a value to a constant to
-	 * be multiplied to countdown value.  */
-	prescalerFlag = _hmcu_readPrescaler();
+	return count;
+}
+#endif
+
+#if (SOFT_TIMER_SHARDED)
+soft_timer_status_t soft_timer_shard_attach(uint8_t shard){
 
-	if(prescalerFlag == 1){
-		prescalerConstant = 1;
-	}else if(prescalerFlag == 10){
-		prescalerConstant = 10;
-	}else if(prescalerFlag == 100){
-		prescalerConstant = 100;
+	/* If soft_timer_init() function was not called yet, return invalid
+	 * state. If the shard does not exist, return invalid parameter. */
+	if(!soft_timer_initialized){
+		return SOFT_TIMER_STATUS_INVALID_STATE;
+	}
+	if(shard >= SOFT_TIMER_CHANNELS){
+		return SOFT_TIMER_STATUS_INVALID_PARAMETER;
 	}
 
-	/* Update countdown variable of every item. */
-	cdValue = _hmcu_readCountdown()*prescalerConstant;
-	for(i = 0 ; i < queue_items_qty ; i++){
-		queue_sorted[i]->countdown -= cdValue;
+	/* Route the interrupt of the channel to the calling thread or core,
+	 * which owns the shard from now on, and enable it, so the commands of
+	 * the other shards are applied even before it starts a timer. */
+	_hmcu_bindChannel(shard);
+	if(!queue_channels[shard].irq_handled){
+		_hmcu_enableIRQ(shard);
 	}
+
+	return SOFT_TIMER_STATUS_SUCCESS;
+}
+#endif
+
+void soft_timer_irq_handler(void){
+
+	/* Single hardware timer ports only have the channel 0. */
+	soft_timer_channel_irq_handler(0);
 }
 
-static void	_st_QUEUE_juxtaposeItems(void){
+void soft_timer_channel_irq_handler(uint8_t channel){
 
-	uint8_t index = 0;
+#if (SOFT_TIMER_STATS)
+	st_channel * ch;
+	uint64_t start;
+	uint32_t spent;
+#endif
 
-	/* Juxtapose the items inside the queue. */
-	while(index < queue_items_qty){
-		if(queue_sorted[index] == NULL){
-			queue_sorted[index] = queue_sorted[index+1];
-			queue_sorted[index+1] = NULL;
+	if(channel >= SOFT_TIMER_CHANNELS){
+		return;
+	}
+
+	/* Serve the queue of the channel. With the statistics, also count the
+	 * time spent doing it. */
+#if (SOFT_TIMER_STATS)
+	ch = &queue_channels[channel];
+	start = _hmcu_readMonotonic();
+	_st_QUEUE_serveIRQ(ch);
+	spent = (uint32_t)(_hmcu_readMonotonic() - start);
+	ch->stats_irqs++;
+	ch->stats_irq_us += spent;
+	if(spent > ch->stats_irq_max){
+		ch->stats_irq_max = spent;
+	}
+#else
+	_st_QUEUE_serveIRQ(&queue_channels[channel]);
+#endif
+}
+
+/*****************************************************************************
+ * Bodies of private functions.
+ *****************************************************************************/
+
+static void _st_LIST_initPool(uint8_t pool){
+
+	st_pool * p_pool = &list_pools[pool];
+#if (SOFT_TIMER_SCALABLE)
+	uint32_t chunk, chunks_qty;
+#else
+	uint32_t first, last;
+#endif
+
+	/* Chain every position of the pool at its free list. In scalable mode
+	 * only the chunks already allocated to the pool are chained, and they
+	 * are kept for the next creations. The end of the list is marked by
+	 * SOFT_TIMER_MAX_INSTANCES. */
+	p_pool->list_capacity = 0;
+	p_pool->list_free_head = SOFT_TIMER_MAX_INSTANCES;
+#if (SOFT_TIMER_SCALABLE)
+	chunks_qty = (list_chunks_qty < _ST_CHUNKS) ? list_chunks_qty : _ST_CHUNKS;
+	for(chunk = chunks_qty ; chunk > 0; chunk--){
+#if (SOFT_TIMER_SHARDED)
+		if(list_chunk_pool[chunk - 1] != pool){
+			continue;
 		}
-		index++;
+#endif
+		_st_LIST_chainRange(p_pool, (chunk - 1)*SOFT_TIMER_CHUNK_SIZE,
+							chunk*SOFT_TIMER_CHUNK_SIZE);
 	}
+#else
+	first = (uint32_t)pool*_ST_POOL_SPAN;
+	last = first + _ST_POOL_SPAN;
+	if(first < SOFT_TIMER_MAX_INSTANCES){
+		_st_LIST_chainRange(p_pool, first, last);
+	}
+#endif
+	p_pool->list_items_qty = 0;
+	p_pool->list_high_water = 0;
+	p_pool->list_exhausted = 0;
 }
 
-static void	_st_QUEUE_sortByCountdown(void){
+static void _st_LIST_chainRange(st_pool * p_pool, uint32_t first,
+								uint32_t last){
 
-	tmr_instance * tmp_ptr;
-	uint8_t i, j;
+	uint32_t i;
 
-	/* Bubble sort to reorder by ascending order, according to countdown value. */
-	for (i = 0; i < queue_items_qty-1; i++){
-		/* Last i elements are already in place */
-		for (j = 0; j < queue_items_qty-i-1; j++){
-			if (queue_sorted[j]->countdown > queue_sorted[j+1]->countdown){
-				tmp_ptr = queue_sorted[j+1];
-				queue_sorted[j+1] = queue_sorted[j];
-				queue_sorted[j] = tmp_ptr;
-			}
-		}
+	/* Push the positions from first up to last, excluded, at the head of
+	 * the free list, in order. The last chunk may be only partially used,
+	 * if the capacity is not a multiple of the chunk size. */
+	if(last > SOFT_TIMER_MAX_INSTANCES){
+		last = SOFT_TIMER_MAX_INSTANCES;
+	}
+	for(i = first ; i < last; i++){
+		_st_LIST_instanceAt((st_index_t)i)->p_timer = NULL;
+		_st_LIST_instanceAt((st_index_t)i)->list_next = (st_index_t)(i + 1);
 	}
+	_st_LIST_instanceAt((st_index_t)(last - 1))->list_next =
+			p_pool->list_free_head;
+	p_pool->list_free_head = (st_index_t)first;
+	p_pool->list_capacity += (st_index_t)(last - first);
 }
 
-static void	_st_QUEUE_parserAndSet(void){
+static uint8_t _st_LIST_currentPool(void){
 
-	uint16_t cntValue_1, cntValue_10, cntValue_100;
+	/* In sharded mode the pool is the one of the shard owning the calling
+	 * thread or core, or none. */
+#if (SOFT_TIMER_SHARDED)
+	return _hmcu_readContext();
+#else
+	return 0;
+#endif
+}
 
-	/* 'Parse' the countdown value and set the prescaler and CNT
-	 * register.
-	 * Since CNT register is 16 bits, we can store up to number 65535.
-	 * So, the idea here is to store in this register a number up to
-	 * 10000, and for numbers above its needed to set prescaler, and
-	 * divide the number to be store to its referent prescaler.
-	 * In this way, times up to 9.999 ms will have a maximum delay of
-	 * 1 ms, up to 99.999 ms will have maximum delay of 10 ms, and so
-	 * on.
-	 * For example, parsing 28.543 ms to countdown: first, the number
-	 * 8543 will be write to CNT register and set 1 as prescaler on
-	 * CTRL register, having 1 ms of imprecision. On the other moment,
-	 * 2000 will be write on CNT register and set 10 as prescaler on
-	 * CTRL register, having 10 ms of imprecision. */
-
-	cntValue_1 = (uint16_t)((queue_sorted[0]->countdown)%10000);
-	if(cntValue_1 != 0){
-		_hmcu_setPrescaler(1);
-		_hmcu_setCountdown(cntValue_1);
-		last_updated_value = cntValue_1;
-		return;
+static uint8_t _st_LIST_poolOf(tmr_instance * tmr_inst){
+
+	/* The channel of an instance is the shard that created it. */
+#if (SOFT_TIMER_SHARDED)
+	return tmr_inst->channel;
+#else
+	(void)tmr_inst;
+	return 0;
+#endif
+}
+
+static bool _st_LIST_reserveInstance(uint8_t pool){
+
+	st_pool * p_pool = &list_pools[pool];
+#if (SOFT_TIMER_SCALABLE)
+	uint32_t chunk;
+	tmr_instance * new_chunk;
+#if (SOFT_TIMER_ENGINE != SOFT_TIMER_ENGINE_WHEEL)
+	tmr_instance ** new_heap;
+#if (SOFT_TIMER_HEAP_KEYS)
+	uint32_t * new_keys;
+#endif
+	uint8_t channel;
+#endif
+#endif
+
+	/* If the free list of the pool is not empty, there is an instance to
+	 * give. */
+	if(p_pool->list_free_head != SOFT_TIMER_MAX_INSTANCES){
+		return true;
 	}
 
-	cntValue_10 = (uint16_t)((queue_sorted[0]->countdown)%100000);
-	if(cntValue_10 != 0){
-		_hmcu_setPrescaler(10);
-		_hmcu_setCountdown((cntValue_10)/10);
-		last_updated_value = cntValue_10;
-		return;
+#if (SOFT_TIMER_SCALABLE)
+	/* Otherwise grow the pool by one chunk, and the heap of every channel
+	 * the pool serves by the same number of positions, since its queue may
+	 * hold every instance of the pool. This is the only place where memory
+	 * is allocated, and it happens once per chunk. A heap already grown
+	 * when another allocation fails is just kept larger. The chunk is
+	 * zeroed, so no instance of it points to a timer before it is
+	 * chained. */
+	new_chunk = calloc(SOFT_TIMER_CHUNK_SIZE, sizeof(tmr_instance));
+	if(new_chunk == NULL){
+		return false;
 	}
+#if (SOFT_TIMER_ENGINE != SOFT_TIMER_ENGINE_WHEEL)
+	for(channel = 0 ; channel < SOFT_TIMER_CHANNELS; channel++){
+		if((_ST_POOLS > 1) && (channel != pool)){
+			continue;
+		}
+		new_heap = realloc(queue_channels[channel].queue_heap,
+						   ((size_t)p_pool->list_capacity +
+							SOFT_TIMER_CHUNK_SIZE) * sizeof(tmr_instance *));
+		if(new_heap == NULL){
+			free(new_chunk);
+			return false;
+		}
+		queue_channels[channel].queue_heap = new_heap;
+#if (SOFT_TIMER_HEAP_KEYS)
+		new_keys = realloc(queue_channels[channel].queue_keys,
+						   ((size_t)p_pool->list_capacity +
+							SOFT_TIMER_CHUNK_SIZE) * sizeof(uint32_t));
+		if(new_keys == NULL){
+			free(new_chunk);
+			return false;
+		}
+		queue_channels[channel].queue_keys = new_keys;
+#endif
+	}
+#endif
+
+	/* Only then take the next free position of the chunk table, shared by
+	 * the shards. If the pool already reached its capacity, give it up. */
+	chunk = _ST_ATOMIC_FETCH_ADD(list_chunks_qty, 1);
+	if(chunk >= _ST_CHUNKS){
+		free(new_chunk);
+		return false;
+	}
+#if (SOFT_TIMER_SHARDED)
+	list_chunk_pool[chunk] = pool;
+#endif
+	_ST_ATOMIC_STORE(list_chunks[chunk], new_chunk);
+	_st_LIST_chainRange(p_pool, chunk*SOFT_TIMER_CHUNK_SIZE,
+						(chunk + 1)*SOFT_TIMER_CHUNK_SIZE);
+
+	return true;
+#else
+	return false;
+#endif
+}
 
-	cntValue_100 = (uint16_t)((queue_sorted[0]->countdown)%1000000);
-	if(cntValue_100 != 0){
-		_hmcu_setPrescaler(100);
-		_hmcu_setCountdown((cntValue_100)/100);
-		last_updated_value = cntValue_100;
-		return;
+static tmr_instance * _st_LIST_instanceAt(st_index_t index){
+
+	/* Return the address of the instance at the given position of the
+	 * pool. */
+#if (SOFT_TIMER_SCALABLE)
+	return &list_chunks[index / SOFT_TIMER_CHUNK_SIZE]
+					   [index % SOFT_TIMER_CHUNK_SIZE];
+#else
+	return &list_instances[index];
+#endif
+}
+
+static void _st_LIST_createInstance(uint8_t pool, soft_timer_t * p_timer){
+
+	st_pool * p_pool = &list_pools[pool];
+	st_index_t index;
+	tmr_instance * tmp_ptr;
+
+	/* Pop the first position of the free list of the pool. The caller
+	 * already reserved it. */
+	index = p_pool->list_free_head;
+	tmp_ptr = _st_LIST_instanceAt(index);
+	p_pool->list_free_head = tmp_ptr->list_next;
+
+	/* Set some parameters of registering instance. Add by one the
+	 * number of existing instances, and keep its highest value. */
+	tmp_ptr->p_timer = p_timer;
+	tmp_ptr->isSet = false;
+	tmp_ptr->inUse = false;
+	tmp_ptr->isPostponed = false;
+	tmp_ptr->align_shift = 0;
+	tmp_ptr->channel = pool;
+	tmp_ptr->channelFixed = (SOFT_TIMER_SHARDED);
+#if (SOFT_TIMER_DEFERRED)
+	_ST_ATOMIC_STORE(tmp_ptr->dispatchPending, false);
+#endif
+#if (SOFT_TIMER_STATS)
+	_st_STATS_resetInstance(tmp_ptr);
+#endif
+	p_pool->list_items_qty++;
+	if(p_pool->list_items_qty > p_pool->list_high_water){
+		p_pool->list_high_water = p_pool->list_items_qty;
+	}
+
+	/* Give the software timer object the handle of its instance. The
+	 * handle is the position at the table plus one, so zero means that
+	 * there is no instance. */
+	p_timer->handle = (uint32_t)index + 1;
+	_ST_TRACE(SOFT_TIMER_TRACE_CREATE, tmp_ptr->channel, tmp_ptr, pool);
+}
+
+static void _st_LIST_destroyInstance(tmr_instance * tmr_inst){
+
+	st_pool * p_pool = &list_pools[_st_LIST_poolOf(tmr_inst)];
+
+	/* Release the handle of the software timer object, push the position
+	 * back at the head of the free list, and decrement the number of
+	 * existing items. The position is the handle minus one. An expiry
+	 * still waiting at the dispatch ring is dropped. */
+#if (SOFT_TIMER_DEFERRED)
+	_ST_ATOMIC_STORE(tmr_inst->dispatchPending, false);
+#endif
+	tmr_inst->list_next = p_pool->list_free_head;
+	p_pool->list_free_head = (st_index_t)(tmr_inst->p_timer->handle - 1);
+	tmr_inst->p_timer->handle = 0;
+	tmr_inst->p_timer = NULL;
+	p_pool->list_items_qty--;
+}
+
+static tmr_instance * _st_LIST_whereInstance(soft_timer_t * p_timer){
+
+	uint32_t index;
+
+	/* Decode the handle of the software timer object. The object may be
+	 * uninitialized memory, or a copy of another object, so the handle is
+	 * only accepted if the instance at that position points back to it. In
+	 * scalable mode the chunk of the position has to be allocated, maybe
+	 * just now by another shard. */
+	index = p_timer->handle - 1;
+	if(index >= SOFT_TIMER_MAX_INSTANCES){
+		return NULL;
+	}
+#if (SOFT_TIMER_SCALABLE)
+	if(_ST_ATOMIC_LOAD(list_chunks[index / SOFT_TIMER_CHUNK_SIZE]) == NULL){
+		return NULL;
+	}
+#endif
+	if(_st_LIST_instanceAt((st_index_t)index)->p_timer != p_timer){
+		return NULL;
+	}
+
+	/* If found, return it's address. */
+	return _st_LIST_instanceAt((st_index_t)index);
+}
+
+#if (SOFT_TIMER_DEFERRED)
+static void _st_RING_push(st_channel * ch, tmr_instance * tmr_inst){
+
+	uint32_t head;
+
+	/* If the previous expiry of the item was not dispatched yet, or the
+	 * ring is full, the expiry is lost. Count it. */
+	head = ch->ring_head;
+	if((_ST_ATOMIC_LOAD(tmr_inst->dispatchPending)) ||
+	   (head - _ST_ATOMIC_LOAD(ch->ring_tail) >=
+		SOFT_TIMER_DISPATCH_RING_SIZE)){
+		ch->ring_lost++;
+		return;
+	}
+
+	/* Mark the item as pending, write its position at the ring and only
+	 * then publish it to soft_timer_dispatch(). */
+	_ST_ATOMIC_STORE(tmr_inst->dispatchPending, true);
+	ch->ring_items[head & (SOFT_TIMER_DISPATCH_RING_SIZE - 1)] =
+			(st_index_t)(tmr_inst->p_timer->handle - 1);
+	_ST_ATOMIC_STORE(ch->ring_head, head + 1);
+}
+#endif
+
+#if (SOFT_TIMER_STATS)
+static void _st_STATS_resetInstance(tmr_instance * tmr_inst){
+
+	uint8_t bucket;
+
+	tmr_inst->stats_fires = 0;
+	tmr_inst->stats_expiries = 0;
+	tmr_inst->stats_late_sum = 0;
+	tmr_inst->stats_late_max = 0;
+	tmr_inst->stats_run_max = 0;
+	for(bucket = 0 ; bucket < SOFT_TIMER_STATS_BUCKETS; bucket++){
+		tmr_inst->stats_runs[bucket] = 0;
+	}
+}
+
+static void _st_STATS_expire(st_channel * ch, tmr_instance * tmr_inst){
+
+	uint32_t late;
+
+	/* The item expired, so its deadline is not after the time of the
+	 * queue, and the difference is how late it fired. With a tolerance it
+	 * is counted from the rounded deadline. */
+	late = ch->queue_now - tmr_inst->deadline;
+	tmr_inst->stats_expiries++;
+	tmr_inst->stats_late_sum += late;
+	if(late > tmr_inst->stats_late_max){
+		tmr_inst->stats_late_max = late;
+	}
+}
+
+static void _st_STATS_run(tmr_instance * tmr_inst){
+
+	soft_timer_t * p_timer = tmr_inst->p_timer;
+	uint64_t start;
+	uint32_t spent;
+	uint8_t bucket;
+
+	/* Run the callback and count how long it took, at the bucket of the
+	 * smallest power of two above it. A callback that destroyed its own
+	 * timer is not counted. */
+	start = _hmcu_readMonotonic();
+	tmr_inst->timeout_cb(p_timer);
+	spent = (uint32_t)(_hmcu_readMonotonic() - start);
+	if(tmr_inst->p_timer != p_timer){
+		return;
+	}
+	bucket = 0;
+	while((bucket < SOFT_TIMER_STATS_BUCKETS - 1) && ((spent >> bucket) != 0)){
+		bucket++;
+	}
+	tmr_inst->stats_fires++;
+	tmr_inst->stats_runs[bucket]++;
+	if(spent > tmr_inst->stats_run_max){
+		tmr_inst->stats_run_max = spent;
+	}
+}
+#endif
+
+#if (SOFT_TIMER_TRACE)
+static void _st_TRACE_record(uint8_t event, uint8_t channel,
+							 tmr_instance * tmr_inst, uint32_t value){
+
+	soft_timer_trace_record_t * rec;
+	uint32_t position;
+
+	/* Claim the next position of the ring, so the API and the interrupts
+	 * of every channel may record at the same time without a lock, and
+	 * write the record there. The oldest record is overwritten. */
+	position = _ST_ATOMIC_FETCH_ADD(trace_head, 1);
+	rec = &trace_records[position & (SOFT_TIMER_TRACE_SIZE - 1)];
+	rec->time_us = (uint32_t)_hmcu_readMonotonic();
+	rec->timer = (tmr_inst != NULL) ? tmr_inst->p_timer->handle : 0;
+	rec->value = value;
+	rec->event = event;
+	rec->channel = channel;
+	rec->sequence = (uint16_t)position;
+}
+#endif
+
+#if ((SOFT_TIMER_SHARDED) || (SOFT_TIMER_POSTED))
+static bool _st_INBOX_isLocal(st_channel * ch){
+
+	/* In sharded mode only the shard owning the channel may change its
+	 * queue. In posted mode even the owner posts its commands, unless it is
+	 * called from a callback of the channel, whose interrupt is already
+	 * being handled. */
+#if (SOFT_TIMER_SHARDED)
+	if(ch->hw_channel != _hmcu_readContext()){
+		return false;
+	}
+#endif
+#if (SOFT_TIMER_POSTED)
+	return ch->irq_handled;
+#else
+	(void)ch;
+	return true;
+#endif
+}
+
+static soft_timer_status_t _st_INBOX_push(st_channel * ch,
+										  soft_timer_t * p_timer,
+										  st_command_op op,
+										  const st_command * p_setting){
+
+	st_command * cmd;
+	uint32_t head, sequence;
+
+	/* Claim the position at the head of the inbox. It is free when its
+	 * sequence is the head itself. Another producer may claim it first, and
+	 * the next position is tried then. If it still holds a command not
+	 * taken by the channel, the inbox is full and the command is refused. */
+	head = _ST_ATOMIC_LOAD(ch->inbox_head);
+	while(1){
+		cmd = &ch->inbox_items[head & (SOFT_TIMER_INBOX_SIZE - 1)];
+		sequence = _ST_ATOMIC_LOAD(cmd->sequence);
+		if(sequence == head){
+			if(_ST_ATOMIC_CAS(ch->inbox_head, head, head + 1)){
+				break;
+			}
+		}else if((int32_t)(sequence - head) < 0){
+			return SOFT_TIMER_STATUS_INVALID_STATE;
+		}else{
+			head = _ST_ATOMIC_LOAD(ch->inbox_head);
+		}
+	}
+
+	/* Write the command, publish it to the channel and raise its interrupt,
+	 * which applies it. */
+	cmd->p_timer = p_timer;
+	cmd->op = op;
+	if(p_setting != NULL){
+		cmd->timeout_cb = p_setting->timeout_cb;
+		cmd->reload_us = p_setting->reload_us;
+		cmd->repeat = p_setting->repeat;
+		cmd->align_shift = p_setting->align_shift;
+	}
+	_ST_ATOMIC_STORE(cmd->sequence, head + 1);
+	_hmcu_triggerIRQ(ch->hw_channel);
+
+	return SOFT_TIMER_STATUS_SUCCESS;
+}
+
+static void _st_INBOX_apply(st_channel * ch){
+
+	st_command * cmd;
+	st_command taken;
+	tmr_instance * tmr_inst;
+	soft_timer_t * p_timer;
+	st_command_op op;
+	uint32_t tail;
+
+	/* Take the commands in the order they were published, and free each
+	 * position for the producers right away. A timer destroyed meanwhile,
+	 * or already started or stopped, is left as it is. A timer given
+	 * another channel meanwhile has the command forwarded to that
+	 * channel. A new setting or tolerance is applied like
+	 * soft_timer_set_us() or soft_timer_set_tolerance() would, so the
+	 * commands posted after it see it. */
+	tail = ch->inbox_tail;
+	while(1){
+		cmd = &ch->inbox_items[tail & (SOFT_TIMER_INBOX_SIZE - 1)];
+		if(_ST_ATOMIC_LOAD(cmd->sequence) != tail + 1){
+			break;
+		}
+		taken = *cmd;
+		p_timer = taken.p_timer;
+		op = taken.op;
+		_ST_ATOMIC_STORE(cmd->sequence, tail + SOFT_TIMER_INBOX_SIZE);
+		tail++;
+
+		tmr_inst = _st_LIST_whereInstance(p_timer);
+		if(tmr_inst == NULL){
+			continue;
+		}
+		if(tmr_inst->channel != ch->hw_channel){
+			_st_INBOX_push(&queue_channels[tmr_inst->channel], p_timer, op,
+						   &taken);
+			continue;
+		}
+		if(op == ST_COMMAND_MODIFY){
+			_st_QUEUE_setInstance(tmr_inst, taken.timeout_cb,
+								  taken.reload_us, taken.repeat);
+		}else if(op == ST_COMMAND_TOLERANCE){
+			tmr_inst->align_shift = taken.align_shift;
+		}else if((op != ST_COMMAND_STOP) && (tmr_inst->isSet) &&
+		   (!tmr_inst->inUse)){
+			_st_QUEUE_addInstance(ch, tmr_inst);
+		}else if((op == ST_COMMAND_STOP) && (tmr_inst->inUse)){
+			_ST_TRACE(SOFT_TIMER_TRACE_STOP, ch->hw_channel, tmr_inst,
+					  tmr_inst->deadline);
+			_st_QUEUE_removeInstance(ch, tmr_inst);
+		}else if((op == ST_COMMAND_RESTART) && (tmr_inst->inUse)){
+			_st_QUEUE_restartInstance(ch, tmr_inst);
+		}
+	}
+	ch->inbox_tail = tail;
+}
+#endif
+
+static void _st_QUEUE_initChannel(st_channel * ch, uint8_t channel){
+
+#if (SOFT_TIMER_ENGINE == SOFT_TIMER_ENGINE_WHEEL)
+	uint8_t i, j;
+#elif (!SOFT_TIMER_SCALABLE)
+	st_index_t i;
+#endif
+#if ((SOFT_TIMER_SHARDED) || (SOFT_TIMER_POSTED))
+	uint32_t k;
+#endif
+
+	/* Empty the queue of the channel. In scalable mode the heap is kept
+	 * for the next items. */
+#if (SOFT_TIMER_ENGINE == SOFT_TIMER_ENGINE_WHEEL)
+	for(i = 0 ; i <= SOFT_TIMER_WHEEL_LEVELS; i++){
+		for(j = 0 ; j < 10; j++){
+			ch->wheel_slots[i][j] = NULL;
+		}
+		if(i < SOFT_TIMER_WHEEL_LEVELS){
+			for(j = 0 ; j < 10; j++){
+				ch->wheel_earliest[i][j] = 0;
+			}
+			ch->wheel_occupied[i] = 0;
+			ch->wheel_digits[i] = 0;
+		}
+	}
+#elif (!SOFT_TIMER_SCALABLE)
+	for(i = 0 ; i < SOFT_TIMER_MAX_INSTANCES; i++){
+		ch->queue_heap[i] = 0;
+	}
+#endif
+	ch->queue_items_qty = 0;
+	ch->queue_now = 0;
+	ch->queue_base = 0;
+	ch->queue_alarm = 0;
+#if (!SOFT_TIMER_MONOTONIC)
+	ch->queue_tick_us = 0;
+#endif
+#if (SOFT_TIMER_AUTO_RELOAD)
+	ch->queue_period = 0;
+	ch->queue_periodic = false;
+	_hmcu_setPeriodic(channel, false);
+#endif
+#if (SOFT_TIMER_DEFERRED)
+	ch->ring_head = 0;
+	ch->ring_tail = 0;
+	ch->ring_lost = 0;
+#endif
+#if ((SOFT_TIMER_SHARDED) || (SOFT_TIMER_POSTED))
+	for(k = 0 ; k < SOFT_TIMER_INBOX_SIZE; k++){
+		ch->inbox_items[k].sequence = k;
+	}
+	ch->inbox_head = 0;
+	ch->inbox_tail = 0;
+#endif
+#if (SOFT_TIMER_STATS)
+	ch->stats_irqs = 0;
+	ch->stats_irq_us = 0;
+	ch->stats_irq_max = 0;
+	ch->stats_reprograms = 0;
+#endif
+	ch->hw_channel = channel;
+	ch->irq_handled = false;
+	ch->queue_batched = false;
+
+	/* Keep the capabilities of the hardware timer of the channel, and
+	 * leave it stopped. */
+	_hmcu_readCaps(channel, &ch->queue_caps);
+	if(ch->queue_caps.prescaler_max == 0){
+		ch->queue_caps.prescaler_max = 1;
+	}
+	ch->queue_counter_max = (ch->queue_caps.counter_bits >= 32) ? UINT32_MAX :
+			(((uint32_t)1 << ch->queue_caps.counter_bits) - 1);
+	_hmcu_setCountdown(channel, 0);
+	_hmcu_setPrescaler(channel, 1);
+	_hmcu_stopTimer(channel);
+	_hmcu_disableIRQ(channel);
+}
+
+static void _st_QUEUE_serveIRQ(st_channel * ch){
+
+	tmr_instance * tmr_inst;
+	st_index_t batch;
+	uint8_t channel = ch->hw_channel;
+
+	/* Atribute true to IRQ handled and disable it and stop the hardware
+	 * timer. Other channels keep running. */
+	ch->irq_handled = true;
+	_hmcu_disableIRQ(channel);
+	_st_QUEUE_holdTimer(ch);
+
+#if ((SOFT_TIMER_SHARDED) || (SOFT_TIMER_POSTED))
+	/* Apply first the starts and stops posted at the inbox, in a single
+	 * batch, with the time of the queue up to date, so their timeouts count
+	 * from now. */
+	_st_QUEUE_updateCountdown(ch);
+	_st_INBOX_apply(ch);
+#endif
+
+	/* A spurious interrupt with nothing on the queue has nothing to do.
+	 * The interrupt is enabled again all the same, since the commands
+	 * posted from now on only trigger it. */
+	if(ch->queue_items_qty == 0){
+#if (SOFT_TIMER_AUTO_RELOAD)
+		_st_QUEUE_stopPeriodic(ch);
+#endif
+		_hmcu_enableIRQ(channel);
+		ch->irq_handled = false;
+		return;
+	}
+
+	/* Bring the time of the queue up to date, then execute the callback of
+	 * every item that reached its timeout, so items sharing a deadline
+	 * take a single interrupt. If no item expired, this was only an
+	 * intermediate countdown chunk set by _st_QUEUE_parserAndSet(). The
+	 * batch is limited to the number of items on the queue, so callbacks
+	 * that keep starting timers with a zero timeout leave the rest to the
+	 * next interrupt. */
+	_st_QUEUE_updateCountdown(ch);
+	batch = ch->queue_items_qty;
+
+	while((batch > 0) &&
+		  ((tmr_inst = _st_QUEUE_expiredInstance(ch)) != NULL)){
+
+		/* An item restarted since it was queued did not really expire, and
+		 * only moves to its postponed deadline. */
+		batch--;
+		if(tmr_inst->isPostponed){
+			_st_QUEUE_postponeInstance(ch, tmr_inst);
+			continue;
+		}
+
+		/* Keep the address of the item, since the callback may start or
+		 * stop timers and reorder the queue. In deferred mode the item is
+		 * only pushed at the dispatch ring. */
+		_ST_TRACE(SOFT_TIMER_TRACE_EXPIRE, channel, tmr_inst,
+				  ch->queue_now - tmr_inst->deadline);
+#if (SOFT_TIMER_STATS)
+		_st_STATS_expire(ch, tmr_inst);
+#endif
+#if (SOFT_TIMER_DEFERRED)
+		_st_RING_push(ch, tmr_inst);
+#elif (SOFT_TIMER_STATS)
+		_st_STATS_run(tmr_inst);
+#else
+		tmr_inst->timeout_cb(tmr_inst->p_timer);
+#endif
+
+		/* If the item is still expired, but is set to repeat, reload
+		 * the value. If it is not set to repeat, remove it from the
+		 * queue. If the callback already stopped or restarted it, even on
+		 * another channel, there is nothing else to do with it, but a
+		 * restart kept as a postponed deadline is applied now. */
+		if((tmr_inst->inUse) && (tmr_inst->channel == channel) &&
+		   (_st_QUEUE_isExpired(ch, tmr_inst))){
+
+			if(tmr_inst->isPostponed){
+
+				_st_QUEUE_postponeInstance(ch, tmr_inst);
+
+			}else if(tmr_inst->repeat){
+
+				_st_QUEUE_moveInstance(ch, tmr_inst,
+									   _st_QUEUE_reloadDeadline(ch, tmr_inst));
+
+			}else{
+
+				_st_QUEUE_removeInstance(ch, tmr_inst);
+			}
+		}
+	}
+
+	/* If there is no more items on the queue, just enable the interrupt
+	 * again, for the next posted commands, and return. */
+	if(ch->queue_items_qty == 0){
+#if (SOFT_TIMER_AUTO_RELOAD)
+		_st_QUEUE_stopPeriodic(ch);
+#endif
+		_hmcu_enableIRQ(channel);
+		ch->irq_handled = false;
+		return;
+	}
+
+#if (SOFT_TIMER_AUTO_RELOAD)
+	/* If the periodic item is still alone and was reloaded one period
+	 * later, the hardware timer already counts down to its next deadline,
+	 * and there is nothing to set. */
+	if(_st_QUEUE_keepPeriodic(ch)){
+		_hmcu_startTimer(channel);
+		_hmcu_enableIRQ(channel);
+		ch->irq_handled = false;
+		return;
+	}
+	_hmcu_stopTimer(channel);
+#endif
+
+	/* If there is item on queue, set the registers and start it. With the
+	 * monotonic time base, the time spent by the callbacks is taken into
+	 * account first. */
+#if (SOFT_TIMER_MONOTONIC)
+	_st_QUEUE_updateCountdown(ch);
+#endif
+	_st_QUEUE_parserAndSet(ch);
+	_hmcu_startTimer(channel);
+	_hmcu_enableIRQ(channel);
+	ch->irq_handled = false;
+}
+
+static void _st_QUEUE_disableIRQs(void){
+
+	uint8_t channel;
+
+#if (SOFT_TIMER_SHARDED)
+	/* A shard only changes its own queue and pool, and hands off the rest
+	 * to the other shards, so only its own interrupt is disabled. */
+	channel = _hmcu_readContext();
+	if(channel < SOFT_TIMER_CHANNELS){
+		_hmcu_disableIRQ(channel);
+	}
+#else
+	/* A callback may start or stop the timers of any channel, and the pool
+	 * is shared by all of them, so the interrupts of every channel are
+	 * disabled while a queue or the pool changes. */
+	for(channel = 0 ; channel < SOFT_TIMER_CHANNELS; channel++){
+		_hmcu_disableIRQ(channel);
+	}
+#endif
+}
+
+static void _st_QUEUE_holdTimer(st_channel * ch){
+
+	/* Stop the hardware timer of the channel while its queue changes. A
+	 * periodic hardware timer is left running, since it already counts the
+	 * next period, and stopping it would shift its phase. */
+#if (SOFT_TIMER_AUTO_RELOAD)
+	if(ch->queue_periodic){
+		return;
+	}
+#endif
+	_hmcu_stopTimer(ch->hw_channel);
+}
+
+static void _st_QUEUE_enableIRQs(void){
+
+	uint8_t channel;
+#if (!SOFT_TIMER_POSTED)
+	uint8_t * depth;
+
+	/* Inside a transaction the interrupts stay disabled until it is
+	 * committed. */
+	depth = _st_QUEUE_batchDepth();
+	if((depth != NULL) && (*depth != 0)){
+		return;
+	}
+#endif
+
+	/* Enable the interrupts again, except the one being handled, if called
+	 * from a callback. */
+#if (SOFT_TIMER_SHARDED)
+	channel = _hmcu_readContext();
+	if((channel < SOFT_TIMER_CHANNELS) &&
+	   (!queue_channels[channel].irq_handled)){
+		_hmcu_enableIRQ(channel);
+	}
+#else
+	for(channel = 0 ; channel < SOFT_TIMER_CHANNELS; channel++){
+		if(!queue_channels[channel].irq_handled){
+			_hmcu_enableIRQ(channel);
+		}
+	}
+#endif
+}
+
+static uint8_t * _st_QUEUE_batchDepth(void){
+
+	uint8_t pool;
+
+	/* Transactions are kept per pool, which is per shard in sharded mode.
+	 * A context without a shard has none. */
+	pool = _st_LIST_currentPool();
+	if(pool >= _ST_POOLS){
+		return NULL;
+	}
+	return &queue_batch_depth[pool];
+}
+
+static void _st_QUEUE_holdChannel(st_channel * ch){
+
+	uint8_t * depth;
+
+	/* Stop the hardware timer of the channel while its queue changes. A
+	 * channel reached by a transaction stays held until it is committed,
+	 * with the time of its queue brought up to date once, and its registers
+	 * are only set at the commit. */
+	if(ch->queue_batched){
+		return;
+	}
+	_st_QUEUE_holdTimer(ch);
+	depth = _st_QUEUE_batchDepth();
+	if((depth != NULL) && (*depth != 0) && (!ch->irq_handled)){
+		_st_QUEUE_updateCountdown(ch);
+		ch->queue_batched = true;
+	}
+}
+
+static void _st_QUEUE_releaseChannel(st_channel * ch){
+
+	/* Start the hardware timer again, unless the IRQ handler or the
+	 * transaction holding the channel does it when it is done. */
+	if(!_st_QUEUE_isHeld(ch)){
+		_hmcu_startTimer(ch->hw_channel);
+	}
+}
+
+static bool _st_QUEUE_isHeld(st_channel * ch){
+
+	/* While the IRQ handler or a transaction holds the channel, the time
+	 * of its queue is already up to date, and its registers are set once
+	 * when it is released. */
+	return ((ch->irq_handled) || (ch->queue_batched));
+}
+
+static uint32_t _st_QUEUE_nextDeadline(void){
+
+	st_channel * ch;
+	uint32_t sleep_us = UINT32_MAX, remaining;
+	uint8_t channel;
+
+	/* Take the nearest alarm set at the registers of the channels, which
+	 * is when the next interrupt comes, from the time read now. Nothing is
+	 * brought up to date, so no hardware timer is stopped. An interrupt
+	 * being handled, an expiry waiting for soft_timer_dispatch() or a
+	 * command waiting at an inbox is work to do right away. In sharded mode
+	 * only the channel of the calling shard is taken into account. */
+	for(channel = 0 ; channel < SOFT_TIMER_CHANNELS; channel++){
+
+#if (SOFT_TIMER_SHARDED)
+		if(channel != _hmcu_readContext()){
+			continue;
+		}
+#endif
+		ch = &queue_channels[channel];
+		if(ch->irq_handled){
+			return 0;
+		}
+#if (SOFT_TIMER_DEFERRED)
+		if(_ST_ATOMIC_LOAD(ch->ring_head) != ch->ring_tail){
+			return 0;
+		}
+#endif
+#if ((SOFT_TIMER_SHARDED) || (SOFT_TIMER_POSTED))
+		if(_ST_ATOMIC_LOAD(ch->inbox_items[ch->inbox_tail &
+										   (SOFT_TIMER_INBOX_SIZE - 1)].sequence)
+				== ch->inbox_tail + 1){
+			return 0;
+		}
+#endif
+		if(ch->queue_items_qty == 0){
+			continue;
+		}
+		remaining = ch->queue_alarm - _st_QUEUE_readTime(ch);
+		if((int32_t)remaining <= 0){
+			return 0;
+		}
+		if(remaining < sleep_us){
+			sleep_us = remaining;
+		}
+	}
+
+	return sleep_us;
+}
+
+static void _st_QUEUE_setInstance(tmr_instance * tmr_inst,
+								  soft_timer_callback_t timeout_cb,
+								  uint32_t reload_us, bool repeat){
+
+	/* Attribute respective parameters. If the instance is already on the
+	 * queue, it keeps its current deadline and channel, and the new
+	 * parameters are used from its next timeout on. */
+	tmr_inst->timeout_cb = timeout_cb;
+	tmr_inst->reload_us	= reload_us;
+	tmr_inst->repeat	= repeat;
+	tmr_inst->isSet		= true;
+	if((!tmr_inst->inUse) && (!tmr_inst->channelFixed)){
+		tmr_inst->channel = _st_QUEUE_pickChannel(tmr_inst);
+	}
+	_ST_TRACE(SOFT_TIMER_TRACE_SET, tmr_inst->channel, tmr_inst, reload_us);
+}
+
+static uint8_t _st_QUEUE_pickChannel(tmr_instance * tmr_inst){
+
+	/* Repeating timers with a period up to SOFT_TIMER_FAST_PERIOD_US take
+	 * the channel 0, so its countdowns stay short, with the finest prescaler,
+	 * and are not reprogrammed by the starts and stops of long timeouts.
+	 * The other timers are spread over the remaining channels by their
+	 * position at the pool, to share the work of the interrupts. */
+#if (SOFT_TIMER_CHANNELS > 1)
+	if((tmr_inst->repeat) && (tmr_inst->reload_us <= SOFT_TIMER_FAST_PERIOD_US)){
+		return 0;
+	}
+	return (uint8_t)(1 + (tmr_inst->p_timer->handle - 1) %
+						 (SOFT_TIMER_CHANNELS - 1));
+#else
+	(void)tmr_inst;
+	return 0;
+#endif
+}
+
+#if (SOFT_TIMER_ENGINE == SOFT_TIMER_ENGINE_WHEEL)
+
+static void _st_QUEUE_addInstance(st_channel * ch,
+								  tmr_instance * tmr_inst){
+
+	/* Bring the wheel up to date with the elapsed time. */
+	if(!_st_QUEUE_isHeld(ch)){
+		_st_QUEUE_updateCountdown(ch);
+	}
+
+	/* Set that it is used at queue, and set its absolute deadline. */
+	tmr_inst->inUse = true;
+	tmr_inst->isPostponed = false;
+	tmr_inst->deadline = _st_QUEUE_deadlineAfter(ch, tmr_inst,
+												 tmr_inst->reload_us);
+	_ST_TRACE(SOFT_TIMER_TRACE_START, ch->hw_channel, tmr_inst,
+			  tmr_inst->deadline);
+
+	/* Hash the item into its slot and increment the number of existing
+	 * items at the queue. Set the registers only if the item expires
+	 * before the countdown already running, so frequent starts do not
+	 * keep postponing the interrupt. Inside the IRQ handler or a
+	 * transaction they are set once, after the whole batch. */
+	_st_WHEEL_insert(ch, tmr_inst);
+	ch->queue_items_qty++;
+	if((!_st_QUEUE_isHeld(ch)) &&
+	   ((ch->queue_items_qty == 1) ||
+		(_st_QUEUE_isEarlier(tmr_inst->deadline, ch->queue_alarm)))){
+		_st_QUEUE_parserAndSet(ch);
+	}
+}
+
+static void _st_QUEUE_removeInstance(st_channel * ch,
+									 tmr_instance *tmr_inst){
+
+	/* Attribute false to indicate that it is no more at the queue, unlink
+	 * it from its slot and decrement the number of items on the queue.
+	 * The hardware timer is left as it is: if the item was the next one
+	 * to expire, the interrupt will only find nothing to fire. */
+	tmr_inst->inUse = false;
+	_st_WHEEL_unlink(ch, tmr_inst);
+	ch->queue_items_qty--;
+}
+
+static void	_st_QUEUE_moveInstance(st_channel * ch,
+								   tmr_instance * tmr_inst,
+								   uint32_t deadline){
+
+	/* Move the expired item back to the wheel, at its later deadline. */
+	_st_WHEEL_unlink(ch, tmr_inst);
+	tmr_inst->deadline = deadline;
+	_st_WHEEL_insert(ch, tmr_inst);
+}
+
+static tmr_instance * _st_QUEUE_expiredInstance(st_channel * ch){
+
+	/* The expired items are kept in the extra slot after the levels. */
+	return ch->wheel_slots[SOFT_TIMER_WHEEL_LEVELS][0];
+}
+
+static bool _st_QUEUE_isExpired(st_channel * ch, tmr_instance * tmr_inst){
+
+	(void)ch;
+	return (tmr_inst->wheel_level == SOFT_TIMER_WHEEL_LEVELS);
+}
+
+static uint32_t _st_QUEUE_nextCountdown(st_channel * ch){
+
+	uint8_t level = 0, slot = 0;
+	uint32_t step;
+	tmr_instance * tmp_ptr;
+
+	if(ch->wheel_slots[SOFT_TIMER_WHEEL_LEVELS][0] != NULL){
+		return 0;
+	}
+
+	/* The earliest deadline is at the first occupied slot ahead of the
+	 * cursor, since every later slot is reached after it. The hardware
+	 * timer is set to that deadline rather than to the slot, and the
+	 * slots passed meanwhile are cascaded by _st_WHEEL_advance() at the
+	 * interrupt, so cascades take no interrupt of their own. */
+	step = _st_WHEEL_nextEvent(ch, &level, &slot);
+	if(step == UINT32_MAX){
+		return UINT32_MAX;
+	}
+
+	/* The earliest deadline of a slot is not raised when an item leaves
+	 * it, so it may be too early. Once it is not ahead of the queue any
+	 * more, it is taken again from the items of the slot. */
+	if(!_st_QUEUE_isEarlier(ch->queue_now, ch->wheel_earliest[level][slot])){
+		tmp_ptr = ch->wheel_slots[level][slot];
+		ch->wheel_earliest[level][slot] = tmp_ptr->deadline;
+		for( ; tmp_ptr != NULL ; tmp_ptr = tmp_ptr->slot_next){
+			if(_st_QUEUE_isEarlier(tmp_ptr->deadline,
+								   ch->wheel_earliest[level][slot])){
+				ch->wheel_earliest[level][slot] = tmp_ptr->deadline;
+			}
+		}
+	}
+
+	/* An item is never due before its slot is reached. */
+	if(ch->wheel_earliest[level][slot] - ch->queue_now < step){
+		return step;
+	}
+	return ch->wheel_earliest[level][slot] - ch->queue_now;
+}
+
+static void	_st_QUEUE_updateCountdown(st_channel * ch){
+
+	uint32_t now;
+
+	/* Only the cursor of the wheel moves. The items are touched just when
+	 * their slot is reached. */
+	now = _st_QUEUE_readTime(ch);
+#if (SOFT_TIMER_MONOTONIC)
+	/* The free-running counter never goes back, so the elapsed time is
+	 * taken as it is, even past 2^31 us of idle. */
+	_st_WHEEL_advance(ch, now - ch->queue_now);
+#else
+	if(_st_QUEUE_isEarlier(ch->queue_now, now)){
+		_st_WHEEL_advance(ch, now - ch->queue_now);
+	}
+#endif
+}
+
+static void	_st_WHEEL_insert(st_channel * ch, tmr_instance * tmr_inst){
+
+	uint8_t level, target[SOFT_TIMER_WHEEL_LEVELS];
+	uint32_t delta, maxDelta, sum, carry;
+	tmr_instance ** slot;
+
+	/* Compute how many microseconds are left to the expiry. The value is
+	 * limited to 9 * 10^(LEVELS-1), so the item always lands ahead of the
+	 * cursor. Items beyond that are hashed to the top level, and hashed
+	 * again with their real remaining time when their slot is reached.
+	 * With enough levels the limit does not fit in 32 bits, and no value
+	 * is limited. */
+	maxDelta = 9;
+	for(level = 1 ; level < SOFT_TIMER_WHEEL_LEVELS ; level++){
+		if(maxDelta > UINT32_MAX/10){
+			maxDelta = UINT32_MAX;
+			break;
+		}
+		maxDelta *= 10;
+	}
+	delta = tmr_inst->deadline - ch->queue_now;
+	if((int32_t)delta <= 0){
+		delta = 0;
+	}else if(delta > maxDelta){
+		delta = maxDelta;
+	}
+
+	/* Add the remaining time to the digits of the cursor, like an
+	 * odometer. The item is hashed to the highest level whose digit
+	 * changes, at the slot of the new digit. If no digit changes, the item
+	 * is already expired. */
+	carry = 0;
+	for(level = 0 ; level < SOFT_TIMER_WHEEL_LEVELS ; level++){
+		sum = ch->wheel_digits[level] + (delta % 10) + carry;
+		target[level] = (uint8_t)(sum % 10);
+		carry = sum / 10;
+		delta /= 10;
+	}
+
+	tmr_inst->wheel_level = SOFT_TIMER_WHEEL_LEVELS;
+	tmr_inst->wheel_slot = 0;
+	for(level = SOFT_TIMER_WHEEL_LEVELS ; level > 0 ; level--){
+		if(target[level-1] != ch->wheel_digits[level-1]){
+			tmr_inst->wheel_level = level - 1;
+			tmr_inst->wheel_slot = target[level-1];
+			if((ch->wheel_occupied[level-1] & (1 << target[level-1])) == 0){
+				ch->wheel_earliest[level-1][target[level-1]] =
+						tmr_inst->deadline;
+				ch->wheel_occupied[level-1] |=
+						(uint16_t)(1 << target[level-1]);
+			}else if(_st_QUEUE_isEarlier(tmr_inst->deadline,
+							ch->wheel_earliest[level-1][target[level-1]])){
+				ch->wheel_earliest[level-1][target[level-1]] =
+						tmr_inst->deadline;
+			}
+			break;
+		}
+	}
+
+	/* Push the item at the head of the slot list. */
+	slot = &ch->wheel_slots[tmr_inst->wheel_level][tmr_inst->wheel_slot];
+	tmr_inst->slot_prev = NULL;
+	tmr_inst->slot_next = *slot;
+	if(*slot != NULL){
+		(*slot)->slot_prev = tmr_inst;
+	}
+	*slot = tmr_inst;
+}
+
+static void	_st_WHEEL_unlink(st_channel * ch, tmr_instance * tmr_inst){
+
+	tmr_instance ** slot;
+
+	/* Unlink the item from its slot list. If the slot becomes empty, clear
+	 * its bit at the occupancy map of its level. */
+	slot = &ch->wheel_slots[tmr_inst->wheel_level][tmr_inst->wheel_slot];
+	if(tmr_inst->slot_prev != NULL){
+		tmr_inst->slot_prev->slot_next = tmr_inst->slot_next;
+	}else{
+		*slot = tmr_inst->slot_next;
+	}
+	if(tmr_inst->slot_next != NULL){
+		tmr_inst->slot_next->slot_prev = tmr_inst->slot_prev;
+	}
+	if((*slot == NULL) && (tmr_inst->wheel_level < SOFT_TIMER_WHEEL_LEVELS)){
+		ch->wheel_occupied[tmr_inst->wheel_level] &=
+				(uint16_t)~(1 << tmr_inst->wheel_slot);
+	}
+	tmr_inst->slot_prev = NULL;
+	tmr_inst->slot_next = NULL;
+}
+
+static uint32_t	_st_WHEEL_nextEvent(st_channel * ch, uint8_t * p_level,
+									uint8_t * p_slot){
+
+	uint8_t level, slot;
+	uint32_t granularity = 1, below = 0;
+
+	/* Search level by level for the first occupied slot ahead of the
+	 * cursor. The slot is reached when the digit of its level turns to it
+	 * and every digit below is zero. Lower levels are always reached
+	 * first. The top level is circular, since the odometer wraps there. */
+	for(level = 0 ; level < SOFT_TIMER_WHEEL_LEVELS ; level++){
+
+		if(ch->wheel_occupied[level] != 0){
+
+			for(slot = ch->wheel_digits[level] + 1 ; slot < 10 ; slot++){
+				if(ch->wheel_occupied[level] & (1 << slot)){
+					*p_level = level;
+					*p_slot = slot;
+					return (slot - ch->wheel_digits[level])*granularity - below;
+				}
+			}
+
+			if(level == SOFT_TIMER_WHEEL_LEVELS - 1){
+				for(slot = 0 ; slot < ch->wheel_digits[level] ; slot++){
+					if(ch->wheel_occupied[level] & (1 << slot)){
+						*p_level = level;
+						*p_slot = slot;
+						return (slot + 10 - ch->wheel_digits[level])*granularity
+								- below;
+					}
+				}
+			}
+		}
+
+		below += ch->wheel_digits[level]*granularity;
+		granularity *= 10;
+	}
+
+	/* The wheel is empty. */
+	return UINT32_MAX;
+}
+
+static void	_st_WHEEL_advance(st_channel * ch, uint32_t elapsed){
+
+	uint8_t level, slot, changed;
+	uint32_t step, sum, carry;
+	tmr_instance * tmp_ptr;
+
+	/* Move the cursor in steps that never go past an occupied slot. */
+	while(elapsed > 0){
+
+		step = _st_WHEEL_nextEvent(ch, &level, &slot);
+		if(step > elapsed){
+			step = elapsed;
+		}
+		elapsed -= step;
+		ch->queue_now += step;
+
+		/* Add the step to the digits, and remember the highest level
+		 * whose digit changed. */
+		changed = 0;
+		carry = 0;
+		for(level = 0 ; level < SOFT_TIMER_WHEEL_LEVELS ; level++){
+			sum = ch->wheel_digits[level] + (step % 10) + carry;
+			if((sum % 10) != ch->wheel_digits[level]){
+				changed = level + 1;
+			}
+			ch->wheel_digits[level] = (uint8_t)(sum % 10);
+			carry = sum / 10;
+			step /= 10;
+		}
+
+		/* Cascade policy: from the highest changed level down, the items
+		 * of the slot just reached are hashed again with their remaining
+		 * time, so they fall to a finer level or to the expired list.
+		 * Level 0 is 1 us wide, so its items always expire. */
+		for(level = changed ; level > 0 ; level--){
+			while((tmp_ptr =
+					ch->wheel_slots[level-1][ch->wheel_digits[level-1]])
+					!= NULL){
+				_st_WHEEL_unlink(ch, tmp_ptr);
+				_st_WHEEL_insert(ch, tmp_ptr);
+			}
+		}
+	}
+}
+
+#else
+
+static void _st_QUEUE_addInstance(st_channel * ch,
+								  tmr_instance * tmr_inst){
+
+	/* Bring the time of the queue up to date. */
+	if(!_st_QUEUE_isHeld(ch)){
+		_st_QUEUE_updateCountdown(ch);
+	}
+
+	/* Set that it is used at queue, and set its absolute deadline. */
+	tmr_inst->inUse = true;
+	tmr_inst->isPostponed = false;
+	tmr_inst->deadline = _st_QUEUE_deadlineAfter(ch, tmr_inst,
+												 tmr_inst->reload_us);
+	_ST_TRACE(SOFT_TIMER_TRACE_START, ch->hw_channel, tmr_inst,
+			  tmr_inst->deadline);
+
+	/* Append the address at the bottom of the heap and increment the
+	 * number of existing items at the queue. */
+	tmr_inst->heap_index = ch->queue_items_qty;
+	_ST_HEAP_STORE(ch, ch->queue_items_qty, tmr_inst);
+#if (SOFT_TIMER_HEAP_KEYS)
+	ch->queue_keys[ch->queue_items_qty] = tmr_inst->deadline;
+#endif
+	ch->queue_items_qty++;
+
+	/* Restore the heap order. Set the registers only if the item expires
+	 * before the countdown already running, so frequent starts do not
+	 * keep postponing the interrupt. Inside the IRQ handler or a
+	 * transaction they are set once, after the whole batch. */
+	_st_QUEUE_siftUp(ch, tmr_inst->heap_index);
+	if((!_st_QUEUE_isHeld(ch)) &&
+	   ((ch->queue_items_qty == 1) ||
+		(_st_QUEUE_isEarlier(tmr_inst->deadline, ch->queue_alarm)))){
+		_st_QUEUE_parserAndSet(ch);
+	}
+}
+
+static void _st_QUEUE_removeInstance(st_channel * ch,
+									 tmr_instance *tmr_inst){
+
+	st_index_t index = tmr_inst->heap_index;
+
+	/* Attribute false to indicate that it is no more at the queue. */
+	tmr_inst->inUse = false;
+
+	/* Decrement the number of items on the queue, move the last item of
+	 * the heap to the released position and restore the heap order from
+	 * there. Only one of the sifts will actually move the item. */
+	ch->queue_items_qty--;
+	if(index != ch->queue_items_qty){
+		ch->queue_heap[index] = ch->queue_heap[ch->queue_items_qty];
+#if (SOFT_TIMER_HEAP_KEYS)
+		ch->queue_keys[index] = ch->queue_keys[ch->queue_items_qty];
+#endif
+		_ST_HEAP_ITEM(ch, index)->heap_index = index;
+		_st_QUEUE_siftDown(ch, index);
+		_st_QUEUE_siftUp(ch, index);
+	}
+#if (!SOFT_TIMER_COMPACT)
+	ch->queue_heap[ch->queue_items_qty] = NULL;
+#endif
+
+	/* If it was the first element to be deleted, so update the time and
+	 * set the registers. Inside the IRQ handler or a transaction
+	 * it is done once, after the whole batch. */
+	if((index == 0) && (ch->queue_items_qty != 0) &&
+	   (!_st_QUEUE_isHeld(ch))){
+		_st_QUEUE_updateCountdown(ch);
+		_st_QUEUE_parserAndSet(ch);
+	}
+}
+
+static void	_st_QUEUE_moveInstance(st_channel * ch,
+								   tmr_instance * tmr_inst,
+								   uint32_t deadline){
+
+	/* Move the deadline of the expired item later and sift it down. */
+	tmr_inst->deadline = deadline;
+#if (SOFT_TIMER_HEAP_KEYS)
+	ch->queue_keys[tmr_inst->heap_index] = deadline;
+#endif
+	_st_QUEUE_siftDown(ch, tmr_inst->heap_index);
+}
+
+static tmr_instance * _st_QUEUE_expiredInstance(st_channel * ch){
+
+	/* The root of the heap is the only candidate to be expired. */
+	if((ch->queue_items_qty != 0) &&
+	   (!_st_QUEUE_isEarlier(ch->queue_now, _ST_HEAP_KEY(ch, 0)))){
+		return _ST_HEAP_ITEM(ch, 0);
+	}
+	return NULL;
+}
+
+static bool _st_QUEUE_isExpired(st_channel * ch, tmr_instance * tmr_inst){
+
+	return !_st_QUEUE_isEarlier(ch->queue_now, tmr_inst->deadline);
+}
+
+static uint32_t _st_QUEUE_nextCountdown(st_channel * ch){
+
+	if(!_st_QUEUE_isEarlier(ch->queue_now, _ST_HEAP_KEY(ch, 0))){
+		return 0;
+	}
+	return _ST_HEAP_KEY(ch, 0) - ch->queue_now;
+}
+
+static void	_st_QUEUE_updateCountdown(st_channel * ch){
+
+	uint32_t now;
+
+	/* Only the time of the queue moves. Deadlines are absolute, so no item
+	 * is touched and the heap order stays the same. */
+	now = _st_QUEUE_readTime(ch);
+#if (SOFT_TIMER_MONOTONIC)
+	/* The free-running counter never goes back, so its time is taken as
+	 * it is. After more than 2^31 us of idle it would look earlier than
+	 * the time of the queue, which would then stop for good. */
+	ch->queue_now = now;
+#else
+	if(_st_QUEUE_isEarlier(ch->queue_now, now)){
+		ch->queue_now = now;
+	}
+#endif
+}
+
+static void	_st_QUEUE_swapItems(st_channel * ch, st_index_t index_a,
+								st_index_t index_b){
+
+	tmr_instance * tmp_ptr;
+#if (SOFT_TIMER_HEAP_KEYS)
+	uint32_t tmp_key;
+#endif
+
+	/* Exchange both heap positions and keep the stored indexes in sync. */
+	tmp_ptr = _ST_HEAP_ITEM(ch, index_a);
+	ch->queue_heap[index_a] = ch->queue_heap[index_b];
+	_ST_HEAP_STORE(ch, index_b, tmp_ptr);
+#if (SOFT_TIMER_HEAP_KEYS)
+	tmp_key = ch->queue_keys[index_a];
+	ch->queue_keys[index_a] = ch->queue_keys[index_b];
+	ch->queue_keys[index_b] = tmp_key;
+#endif
+	_ST_HEAP_ITEM(ch, index_a)->heap_index = index_a;
+	tmp_ptr->heap_index = index_b;
+}
+
+static void	_st_QUEUE_siftUp(st_channel * ch, st_index_t index){
+
+	st_index_t parent;
+
+	/* Move the item towards the root while its deadline is earlier than
+	 * its parent's one. */
+	while(index > 0){
+		parent = (index - 1)/2;
+		if(!_st_QUEUE_isEarlier(_ST_HEAP_KEY(ch, index),
+								_ST_HEAP_KEY(ch, parent))){
+			break;
+		}
+		_st_QUEUE_swapItems(ch, parent, index);
+		index = parent;
+	}
+}
+
+static void	_st_QUEUE_siftDown(st_channel * ch, st_index_t index){
+
+	uint32_t child;
+	st_index_t smallest;
+
+	/* Move the item towards the leaves while one of its children has an
+	 * earlier deadline. The child position is computed in 32 bits, so it
+	 * does not wrap around a narrow index type. */
+	while(1){
+		smallest = index;
+		child = 2*(uint32_t)index + 1;
+		if((child < ch->queue_items_qty) &&
+		   (_st_QUEUE_isEarlier(_ST_HEAP_KEY(ch, child),
+								_ST_HEAP_KEY(ch, smallest)))){
+			smallest = (st_index_t)child;
+		}
+		child++;
+		if((child < ch->queue_items_qty) &&
+		   (_st_QUEUE_isEarlier(_ST_HEAP_KEY(ch, child),
+								_ST_HEAP_KEY(ch, smallest)))){
+			smallest = (st_index_t)child;
+		}
+		if(smallest == index){
+			break;
+		}
+		_st_QUEUE_swapItems(ch, index, smallest);
+		index = smallest;
+	}
+}
+
+#endif
+
+static bool _st_QUEUE_isEarlier(uint32_t time_a, uint32_t time_b){
+
+	/* Compare two absolute times of the queue. The difference is taken as
+	 * signed, so the comparison still holds when the time wraps around,
+	 * as long as both are less than 2^31 us apart. */
+	return ((int32_t)(time_a - time_b) < 0);
+}
+
+static void _st_QUEUE_restartInstance(st_channel * ch,
+									  tmr_instance * tmr_inst){
+
+	uint32_t now, deadline;
+
+	/* Compute the deadline of a timeout started now. If it is not earlier
+	 * than the current one, which is the case of a watchdog fed before it
+	 * expires, only keep it as postponed: the item stays where it is, and
+	 * is moved when its current deadline is reached. An earlier deadline,
+	 * after a shorter reload was set, takes a full stop and start. */
+	now = _st_QUEUE_readTime(ch);
+	deadline = _st_QUEUE_alignDeadline(tmr_inst, now +
+											   _st_QUEUE_readSlack(ch, now) +
+											   tmr_inst->reload_us);
+	_ST_TRACE(SOFT_TIMER_TRACE_RESTART, ch->hw_channel, tmr_inst, deadline);
+	if(!_st_QUEUE_isEarlier(deadline, tmr_inst->deadline)){
+		tmr_inst->postponed = deadline;
+		tmr_inst->isPostponed = true;
+		return;
+	}
+	_st_QUEUE_holdChannel(ch);
+	_st_QUEUE_removeInstance(ch, tmr_inst);
+	_st_QUEUE_addInstance(ch, tmr_inst);
+	_st_QUEUE_releaseChannel(ch);
+}
+
+static void _st_QUEUE_postponeInstance(st_channel * ch,
+									   tmr_instance * tmr_inst){
+
+	/* The item reached the deadline it had before being restarted. Move it
+	 * to the postponed one, without running its callback. */
+	tmr_inst->isPostponed = false;
+	_st_QUEUE_moveInstance(ch, tmr_inst, tmr_inst->postponed);
+}
+
+static uint32_t _st_QUEUE_deadlineAfter(st_channel * ch,
+										tmr_instance * tmr_inst,
+										uint32_t timeout_us){
+
+	/* Compute the absolute deadline of a timeout started now, counted from
+	 * the latest time the queue may be at. */
+	return _st_QUEUE_alignDeadline(tmr_inst, ch->queue_now +
+									_st_QUEUE_readSlack(ch, ch->queue_now) +
+									timeout_us);
+}
+
+static uint32_t _st_QUEUE_readSlack(st_channel * ch, uint32_t time){
+
+#if (SOFT_TIMER_MONOTONIC)
+	/* The free-running counter gives the time to the microsecond. */
+	(void)ch;
+	(void)time;
+	return 0;
+#else
+	/* The elapsed time is read in whole counts, so a time read while the
+	 * hardware timer counts may be behind by up to one count. A deadline
+	 * counted from it could then expire early, once the count goes on, so
+	 * it is moved one count later. Only the time of the alarm itself,
+	 * read when the count ended, is exact. */
+	if(time == ch->queue_alarm){
+		return 0;
+	}
+	return ch->queue_tick_us;
+#endif
+}
+
+static uint32_t _st_QUEUE_alignDeadline(tmr_instance * tmr_inst,
+										uint32_t deadline){
+
+	uint32_t mask;
+
+	/* If the item has a tolerance, round the deadline up to the grid of its
+	 * alignment, so items whose windows overlap share the same deadline and
+	 * a single countdown of _st_QUEUE_parserAndSet() fires them together.
+	 * The grid holds across the wrap around, since 2^32 is a multiple of
+	 * it. */
+	mask = ((uint32_t)1 << tmr_inst->align_shift) - 1;
+	return (deadline + mask) & ~mask;
+}
+
+static uint32_t _st_QUEUE_reloadDeadline(st_channel * ch,
+										 tmr_instance * tmr_inst){
+
+	uint32_t period;
+#if (SOFT_TIMER_MONOTONIC)
+	uint32_t deadline;
+#endif
+
+	/* A period of zero is taken as 1 us, so the item leaves the batch. */
+	period = (tmr_inst->reload_us != 0) ? tmr_inst->reload_us : 1;
+
+#if (SOFT_TIMER_MONOTONIC)
+	/* Advance from the previous deadline instead of from now, so the
+	 * latency of the interrupt does not add up and the item keeps its
+	 * phase. Periods that were missed entirely are skipped. The tolerance
+	 * still rounds the deadline up to its grid. */
+	deadline = tmr_inst->deadline + period;
+	if(!_st_QUEUE_isEarlier(ch->queue_now, deadline)){
+		deadline += ((ch->queue_now - deadline)/period + 1)*period;
+	}
+	return _st_QUEUE_alignDeadline(tmr_inst, deadline);
+#else
+	return _st_QUEUE_deadlineAfter(ch, tmr_inst, period);
+#endif
+}
+
+static uint32_t _st_QUEUE_readTime(st_channel * ch){
+
+#if (SOFT_TIMER_MONOTONIC)
+	/* Return the free-running counter, shared by every channel. Only the
+	 * low 32 bits are kept, like every time of the queue. */
+	(void)ch;
+	return (uint32_t)_hmcu_readMonotonic();
+#else
+	/* Return the time of the last setting of the registers, plus the time
+	 * elapsed since then. */
+	return ch->queue_base + _st_QUEUE_readElapsed(ch);
+#endif
+}
+
+static uint32_t _st_QUEUE_countsToMicroseconds(st_channel * ch,
+												 uint32_t counts,
+												 uint32_t prescaler){
+
+	/* Convert counts of the hardware timer to microseconds, rounding down.
+	 * The product is taken in 64 bits, so no clock or prescaler can
+	 * overflow it. */
+	return (uint32_t)(((uint64_t)counts*prescaler*1000000u)/
+					  ch->queue_caps.clock_hz);
+}
+
+#if (!SOFT_TIMER_MONOTONIC)
+static uint32_t _st_QUEUE_readElapsed(st_channel * ch){
+
+	/* Return the elapsed microseconds since the registers were set, at
+	 * queue_base. */
+	return _st_QUEUE_countsToMicroseconds(ch,
+										  _hmcu_readCountdown(ch->hw_channel),
+										  _hmcu_readPrescaler(ch->hw_channel));
+}
+#endif
+
+static void	_st_QUEUE_parserAndSet(st_channel * ch){
+
+	uint32_t countdown, prescaler, counts;
+	uint64_t clockCounts;
+
+	/* 'Parse' the countdown value and set the prescaler and CNT
+	 * register.
+	 * The countdown is first taken in counts of the clock. The prescaler
+	 * is then the smallest division that makes them fit in the counter,
+	 * which gives the finest resolution, and the counts are rounded up,
+	 * so the interrupt is never early and is late by less than one count.
+	 * Without the monotonic time base, a deadline counted from a time read
+	 * between two counts is set one count later, see
+	 * _st_QUEUE_readSlack(), so a timeout may be late by up to two
+	 * counts.
+	 * For example, 28.543 ms on a 16 MHz clock with a 16-bit counter are
+	 * 456688 counts of the clock: the prescaler is 7, and 65242 counts of
+	 * 0.4375 us are set.
+	 * If even the largest prescaler is not enough, the longest countdown
+	 * is set. The interrupt then finds nothing expired and sets the rest,
+	 * so long timeouts take as few interrupts as the counter allows. */
+
+	ch->queue_base = ch->queue_now;
+	countdown = _st_QUEUE_nextCountdown(ch);
+
+	/* The countdown is zero when an item expired while the interrupt was
+	 * not served yet. Set the smallest countdown anyway, so the count
+	 * restarts from now and the elapsed time is not taken into account
+	 * twice by _st_QUEUE_updateCountdown(). */
+	if(countdown == 0){
+		countdown = 1;
+	}
+
+	clockCounts = ((uint64_t)countdown*ch->queue_caps.clock_hz + 999999u)/
+				  1000000u;
+	prescaler = (uint32_t)((clockCounts + ch->queue_counter_max - 1)/
+						   ch->queue_counter_max);
+	if(prescaler == 0){
+		prescaler = 1;
+	}else if(prescaler > ch->queue_caps.prescaler_max){
+		prescaler = ch->queue_caps.prescaler_max;
+	}
+
+	if(clockCounts > (uint64_t)ch->queue_counter_max*prescaler){
+		counts = ch->queue_counter_max;
+	}else{
+		counts = (uint32_t)((clockCounts + prescaler - 1)/prescaler);
+	}
+
+#if (SOFT_TIMER_AUTO_RELOAD)
+	/* If the countdown is the period of a lone repeating item, and the
+	 * counts give it exactly, let the hardware timer reload it by itself.
+	 * Otherwise go back to a one-shot countdown. A periodic hardware timer
+	 * is still running, and is stopped before its registers are set. */
+	if(ch->queue_periodic){
+		_hmcu_stopTimer(ch->hw_channel);
+	}
+	if(_st_QUEUE_isPeriodic(ch, countdown, clockCounts) &&
+	   (clockCounts == (uint64_t)counts*prescaler)){
+		ch->queue_period = countdown;
+		if(!ch->queue_periodic){
+			_hmcu_setPeriodic(ch->hw_channel, true);
+			ch->queue_periodic = true;
+		}
+	}else if(ch->queue_periodic){
+		_hmcu_setPeriodic(ch->hw_channel, false);
+		ch->queue_periodic = false;
+	}
+#endif
+
+	_hmcu_setPrescaler(ch->hw_channel, prescaler);
+	_hmcu_setCountdown(ch->hw_channel, counts);
+	ch->queue_alarm = ch->queue_now +
+					  _st_QUEUE_countsToMicroseconds(ch, counts, prescaler);
+#if (!SOFT_TIMER_MONOTONIC)
+	/* One count in microseconds, rounded up, plus the microsecond the
+	 * elapsed time loses when rounded down. */
+	ch->queue_tick_us = (uint32_t)(((uint64_t)prescaler*1000000u +
+									ch->queue_caps.clock_hz - 1)/
+								   ch->queue_caps.clock_hz) + 1;
+#endif
+#if (SOFT_TIMER_STATS)
+	ch->stats_reprograms++;
+#endif
+	_ST_TRACE(SOFT_TIMER_TRACE_REPROGRAM, ch->hw_channel, NULL,
+			  ch->queue_alarm - ch->queue_now);
+}
+
+#if (SOFT_TIMER_AUTO_RELOAD)
+static tmr_instance * _st_QUEUE_firstInstance(st_channel * ch){
+
+#if (SOFT_TIMER_ENGINE == SOFT_TIMER_ENGINE_WHEEL)
+	uint8_t level, slot;
+
+	/* Return the item of the first occupied slot found. It is only called
+	 * with a single item on the wheel. */
+	if(ch->wheel_slots[SOFT_TIMER_WHEEL_LEVELS][0] != NULL){
+		return ch->wheel_slots[SOFT_TIMER_WHEEL_LEVELS][0];
+	}
+	for(level = 0 ; level < SOFT_TIMER_WHEEL_LEVELS ; level++){
+		if(ch->wheel_occupied[level] != 0){
+			for(slot = 0 ; slot < 10 ; slot++){
+				if(ch->wheel_occupied[level] & (1 << slot)){
+					return ch->wheel_slots[level][slot];
+				}
+			}
+		}
+	}
+	return NULL;
+#else
+	/* The root of the heap is the earliest item. */
+	return _ST_HEAP_ITEM(ch, 0);
+#endif
+}
+
+static bool _st_QUEUE_isPeriodic(st_channel * ch, uint32_t countdown,
+								 uint64_t clockCounts){
+
+	tmr_instance * tmr_inst;
+
+	/* The hardware timer can only repeat the countdown of a repeating item
+	 * that is alone on the queue of its channel, and only if the countdown
+	 * is its whole period, in a whole number of counts of the clock. */
+	if(ch->queue_items_qty != 1){
+		return false;
+	}
+	tmr_inst = _st_QUEUE_firstInstance(ch);
+	return ((tmr_inst != NULL) && (tmr_inst->repeat) &&
+			(tmr_inst->reload_us == countdown) &&
+			(clockCounts*1000000u ==
+			 (uint64_t)countdown*ch->queue_caps.clock_hz));
+}
+
+static bool _st_QUEUE_keepPeriodic(st_channel * ch){
+
+	tmr_instance * tmr_inst;
+
+	/* The hardware timer reloaded at the alarm, so it expires again one
+	 * period later. Keep it if the item is still alone, with the same
+	 * period, and its new deadline is that expiry. */
+	if((!ch->queue_periodic) || (ch->queue_items_qty != 1)){
+		return false;
+	}
+	tmr_inst = _st_QUEUE_firstInstance(ch);
+	if((tmr_inst == NULL) || (!tmr_inst->repeat) ||
+	   (tmr_inst->reload_us != ch->queue_period) ||
+	   (tmr_inst->deadline != ch->queue_alarm + ch->queue_period)){
+		return false;
+	}
+	ch->queue_base = ch->queue_alarm;
+	ch->queue_alarm += ch->queue_period;
+	return true;
+}
+
+static void _st_QUEUE_stopPeriodic(st_channel * ch){
+
+	/* Leave the periodic mode, so the hardware timer does not keep
+	 * interrupting an empty queue. */
+	if(ch->queue_periodic){
+		_hmcu_stopTimer(ch->hw_channel);
+		_hmcu_setPeriodic(ch->hw_channel, false);
+		ch->queue_periodic = false;
 	}
 }
+#endif
@@ -36,6 +36,84 @@ typedef enum soft_timer_status
     SOFT_TIMER_STATUS_INVALID_STATE     /**< Failure: invalid timer state. */
 } soft_timer_status_t;
 
+/**
+ * @brief Usage counters of the static pool of timer instances.
+ */
+typedef struct soft_timer_pool_stats
+{
+    uint32_t capacity;   /**< Number of instances of the pool. */
+    uint32_t in_use;     /**< Instances currently created. */
+    uint32_t high_water; /**< Most instances ever created at the same time. */
+    uint32_t exhausted;  /**< Creations refused because the pool was empty. */
+    uint32_t bytes;      /**< Memory held by the pool and the queue. */
+    uint32_t dispatch_lost; /**< Expiries not pushed at the dispatch ring,
+                                 because it was full or the previous one of
+                                 the timer was not dispatched yet. */
+} soft_timer_pool_stats_t;
+
+#if (SOFT_TIMER_STATS)
+/**
+ * @brief Runtime counters of a timer. Only available with SOFT_TIMER_STATS.
+ */
+typedef struct soft_timer_stats
+{
+    uint32_t fires;        /**< Callbacks run since the timer was created. */
+    uint32_t late_max_us;  /**< Latest expiry after its deadline, in
+                                microseconds of the time of the queue. */
+    uint32_t late_mean_us; /**< Mean lateness of the expiries. */
+    uint32_t run_max_us;   /**< Longest callback. */
+    uint32_t run_hist[SOFT_TIMER_STATS_BUCKETS]; /**< Callbacks by duration,
+                                check SOFT_TIMER_STATS_BUCKETS. */
+} soft_timer_stats_t;
+
+/**
+ * @brief Counters of the interrupts, added up over every channel. Only
+ * available with SOFT_TIMER_STATS.
+ */
+typedef struct soft_timer_irq_stats
+{
+    uint32_t irqs;       /**< Runs of the interrupt handler. */
+    uint64_t irq_us;     /**< Time spent in the handler, callbacks
+                              included, unless deferred. */
+    uint32_t irq_max_us; /**< Longest run of the handler. */
+    uint32_t reprograms; /**< Settings of the prescaler and countdown. */
+} soft_timer_irq_stats_t;
+#endif
+
+#if (SOFT_TIMER_TRACE)
+/**
+ * @brief Events of the trace. Only available with SOFT_TIMER_TRACE.
+ */
+typedef enum soft_timer_trace_event
+{
+    SOFT_TIMER_TRACE_CREATE = 0, /**< Instance created, value is its pool. */
+    SOFT_TIMER_TRACE_SET,        /**< Timer set, value is its reload in us. */
+    SOFT_TIMER_TRACE_START,      /**< Timer queued, value is its deadline. */
+    SOFT_TIMER_TRACE_STOP,       /**< Timer stopped, value is its deadline. */
+    SOFT_TIMER_TRACE_RESTART,    /**< Deadline postponed, value is the new
+                                      deadline. */
+    SOFT_TIMER_TRACE_EXPIRE,     /**< Timer expired, value is how late, in
+                                      us. */
+    SOFT_TIMER_TRACE_REPROGRAM   /**< Registers set, value is the countdown
+                                      in us. The timer is zero. */
+} soft_timer_trace_event_t;
+
+/**
+ * @brief Record of the trace, 16 bytes, written in the byte order of the
+ * target. Deadlines are given in the time of the queue of the channel.
+ */
+typedef struct soft_timer_trace_record
+{
+    uint32_t time_us;  /**< Low 32 bits of _hmcu_readMonotonic(). */
+    uint32_t timer;    /**< Handle of the timer, zero for none. */
+    uint32_t value;    /**< Depends on the event. */
+    uint8_t  event;    /**< Check @ref soft_timer_trace_event_t. */
+    uint8_t  channel;  /**< Channel of the timer. */
+    uint16_t sequence; /**< Low 16 bits of the position of the record, so
+                            lost records show as a gap. */
+} soft_timer_trace_record_t;
+#endif
+
 /*****************************************************************************
  * Public functions.
  *****************************************************************************/
@@ -54,7 +132,11 @@ extern void soft_timer_init(void);
 extern void soft_timer_create(soft_timer_t *p_timer);
 
 /**
- * @brief Configure countdown timer.
+ * @brief Configure countdown timer. A running timer keeps its deadline, and
+ * the new setting is used from its next timeout on. With SOFT_TIMER_POSTED,
+ * or for a timer of another shard, a timer already set is set again only
+ * through the inbox of its channel, like the start, so the commands posted
+ * after it see the new setting.
  *
  * @param p_timer    Pointer to timer instance to be configured.
  * @param timeout_cb Pointer to timeout callback function.
@@ -70,7 +152,57 @@ extern soft_timer_status_t soft_timer_set(soft_timer_t          *p_timer,
 										  bool                   repeat);
 
 /**
- * @brief Start timer.
+ * @brief Configure countdown timer, with a timeout in microseconds. It is
+ * posted like soft_timer_set().
+ *
+ * @param p_timer    Pointer to timer instance to be configured.
+ * @param timeout_cb Pointer to timeout callback function.
+ * @param reload_us  Value to reload timer in microseconds, up to
+ *                   SOFT_TIMER_MAX_RELOAD_US. The error is bounded by one
+ *                   count of the prescaler chosen for the countdown.
+ * @param repeat     Boolean flag signalling if timer should repeat after
+ *                   timeout.
+ *
+ * @return Operation status. Check @ref soft_timer_status_t.
+ */
+extern soft_timer_status_t soft_timer_set_us(soft_timer_t          *p_timer,
+											 soft_timer_callback_t  timeout_cb,
+											 uint32_t               reload_us,
+											 bool                   repeat);
+
+/**
+ * @brief Configure how late a timer may fire. Its deadlines are then moved
+ * to a coarser grid shared by every timer, so timers with overlapping
+ * windows fire at the same interrupt. It is posted like soft_timer_set().
+ *
+ * @param p_timer      Pointer to timer instance to be configured.
+ * @param tolerance_ms Milliseconds the timer may fire after its timeout.
+ *                     Zero, the default, fires it at the timeout. It is used
+ *                     from the next start or reload on.
+ *
+ * @return Operation status. Check @ref soft_timer_status_t.
+ */
+extern soft_timer_status_t soft_timer_set_tolerance(soft_timer_t *p_timer,
+													uint32_t tolerance_ms);
+
+/**
+ * @brief Give a timer its hardware channel, instead of the one picked when it
+ * is set. Only useful with several SOFT_TIMER_CHANNELS.
+ *
+ * @param p_timer Pointer to timer instance to be configured.
+ * @param channel Channel of the timer, from 0 to SOFT_TIMER_CHANNELS - 1.
+ *                The timer has to be stopped.
+ *
+ * @return Operation status. Check @ref soft_timer_status_t.
+ */
+extern soft_timer_status_t soft_timer_set_channel(soft_timer_t *p_timer,
+												  uint8_t channel);
+
+/**
+ * @brief Start timer. With SOFT_TIMER_POSTED, or for a timer of another
+ * shard, the start is only posted at the inbox of the channel of the timer,
+ * and applied by its interrupt: success then means it is queued, and starting
+ * a timer already running is ignored when it is applied.
  *
  * @param p_timer    Pointer to timer instance to be started.
  *
@@ -79,7 +211,9 @@ extern soft_timer_status_t soft_timer_set(soft_timer_t          *p_timer,
 extern soft_timer_status_t soft_timer_start(soft_timer_t *p_timer);
 
 /**
- * @brief Stop timer.
+ * @brief Stop timer. With SOFT_TIMER_POSTED, or for a timer of another shard,
+ * the stop is only posted, like the start, so the timer may still fire until
+ * it is applied.
  *
  * @param p_timer    Pointer to timer instance to be started.
  *
@@ -87,6 +221,88 @@ extern soft_timer_status_t soft_timer_start(soft_timer_t *p_timer);
  */
 extern soft_timer_status_t soft_timer_stop(soft_timer_t *p_timer);
 
+/**
+ * @brief Restart timer, so it expires one timeout from now, like a stop
+ * followed by a start. It is meant for watchdogs and idle timeouts fed
+ * before they expire: when the new deadline is not earlier than the current
+ * one, it is only kept at the instance, and the timer is moved to it when
+ * its current deadline is reached, without running its callback. A stopped
+ * timer is just started. To change the timeout too, call soft_timer_set()
+ * first. It is posted like the start, when the start would be.
+ *
+ * @param p_timer    Pointer to timer instance to be restarted.
+ *
+ * @return Operation status. Check @ref soft_timer_status_t.
+ */
+extern soft_timer_status_t soft_timer_restart(soft_timer_t *p_timer);
+
+/**
+ * @brief Start a set of timers at once. The interrupts are disabled once,
+ * and the registers of every channel are set once, after all the timers are
+ * on their queues.
+ *
+ * @param pp_timers  Array of pointers to the timer instances to be started.
+ * @param count      Number of pointers of the array.
+ *
+ * @return Status of the first timer that could not be started, the others
+ *         are started anyway. Check @ref soft_timer_status_t.
+ */
+extern soft_timer_status_t soft_timer_start_many(soft_timer_t * const *pp_timers,
+												 uint32_t count);
+
+/**
+ * @brief Stop a set of timers at once, like soft_timer_start_many().
+ *
+ * @param pp_timers  Array of pointers to the timer instances to be stopped.
+ * @param count      Number of pointers of the array.
+ *
+ * @return Status of the first timer that could not be stopped, the others
+ *         are stopped anyway. Check @ref soft_timer_status_t.
+ */
+extern soft_timer_status_t soft_timer_stop_many(soft_timer_t * const *pp_timers,
+												uint32_t count);
+
+/**
+ * @brief Open a transaction. Until soft_timer_commit(), the interrupts stay
+ * disabled, and the starts and stops only change the queues: the hardware
+ * timers they reach are held, and set once at the commit. Transactions may
+ * be nested, and only the outermost commit sets the registers. Keep them
+ * short, since the timers of a held channel do not fire meanwhile.
+ *
+ * @return Operation status. Check @ref soft_timer_status_t.
+ */
+extern soft_timer_status_t soft_timer_begin(void);
+
+/**
+ * @brief Close the transaction opened by soft_timer_begin(), setting the
+ * registers of every channel it changed and enabling the interrupts again.
+ *
+ * @return Invalid state if no transaction is open. Check
+ *         @ref soft_timer_status_t.
+ */
+extern soft_timer_status_t soft_timer_commit(void);
+
+/**
+ * @brief Read how long until the next interrupt of the software timer,
+ * without stopping the hardware timers, so the application or the idle task
+ * of an RTOS can choose how deep to sleep. The interrupt may only be an
+ * intermediate countdown of a long timeout. In sharded mode only the shard
+ * of the calling thread or core is taken into account.
+ *
+ * @return Microseconds until the next interrupt, zero if there is work to do
+ *         already, or UINT32_MAX if no timer is running.
+ */
+extern uint32_t soft_timer_next_deadline(void);
+
+/**
+ * @brief Sleep until the next interrupt, through _hmcu_idle(), which is
+ * given the time left to choose the sleep state. Meant to be called from
+ * the idle loop, instead of a periodic tick. It returns right away if there
+ * is work to do already, and otherwise after the next interrupt, of the
+ * software timer or of the port.
+ */
+extern void soft_timer_idle(void);
+
 /**
  * @brief Deallocate software timer instance.
  *
@@ -96,8 +312,87 @@ extern soft_timer_status_t soft_timer_stop(soft_timer_t *p_timer);
 extern void soft_timer_destroy(soft_timer_t *p_timer);
 
 /**
- * @brief
+ * @brief Read the usage counters of the pool of timer instances.
+ *
+ * @param p_stats Output parameter: Pointer to the counters to be filled.
+ */
+extern void soft_timer_get_pool_stats(soft_timer_pool_stats_t *p_stats);
+
+#if (SOFT_TIMER_STATS)
+/**
+ * @brief Read the runtime counters of a timer. Only available with
+ * SOFT_TIMER_STATS. The counters start from zero when the timer is created.
+ *
+ * @param p_timer Pointer to timer instance.
+ * @param p_stats Output parameter: Pointer to the counters to be filled.
+ *
+ * @return Operation status. Check @ref soft_timer_status_t.
+ */
+extern soft_timer_status_t soft_timer_get_stats(soft_timer_t *p_timer,
+												soft_timer_stats_t *p_stats);
+
+/**
+ * @brief Read the counters of the interrupts since soft_timer_init(). Only
+ * available with SOFT_TIMER_STATS.
+ *
+ * @param p_stats Output parameter: Pointer to the counters to be filled.
+ */
+extern void soft_timer_get_irq_stats(soft_timer_irq_stats_t *p_stats);
+#endif
+
+#if (SOFT_TIMER_TRACE)
+/**
+ * @brief Copy the most recent records of the trace, oldest first. Only
+ * available with SOFT_TIMER_TRACE. A record being written by another shard
+ * meanwhile may be copied half written.
+ *
+ * @param p_records Output parameter: Array to be filled.
+ * @param count     Number of records of the array.
+ *
+ * @return Number of records copied.
+ */
+extern uint32_t soft_timer_trace_dump(soft_timer_trace_record_t *p_records,
+									  uint32_t count);
+#endif
+
+#if (SOFT_TIMER_DEFERRED)
+/**
+ * @brief Run the callbacks of the timers expired since the last call. Only
+ * available with SOFT_TIMER_DEFERRED. It has to be called from one context
+ * only, like the main loop or a worker thread.
+ *
+ * @return Number of callbacks run.
+ */
+extern uint32_t soft_timer_dispatch(void);
+#endif
+
+#if (SOFT_TIMER_SHARDED)
+/**
+ * @brief Make the calling thread or core the owner of a shard. Only
+ * available with SOFT_TIMER_SHARDED. The interrupt of the channel of the
+ * shard is routed to it, and the timers it creates belong to the shard. It
+ * sets, destroys and dispatches only its own timers. Starting or stopping
+ * the timers of another shard hands the command off to that shard, and
+ * returns success once it is queued, or invalid state if the inbox of the
+ * shard is full.
+ *
+ * @param shard Shard to be owned, from 0 to SOFT_TIMER_CHANNELS - 1.
+ *
+ * @return Operation status. Check @ref soft_timer_status_t.
+ */
+extern soft_timer_status_t soft_timer_shard_attach(uint8_t shard);
+#endif
+
+/**
+ * @brief Interrupt handler of the hardware timer of the channel 0.
  */
 extern void soft_timer_irq_handler(void);
 
+/**
+ * @brief Interrupt handler of the hardware timer of a channel.
+ *
+ * @param channel Channel whose hardware timer raised the interrupt.
+ */
+extern void soft_timer_channel_irq_handler(uint8_t channel);
+
 #endif /** __SOFT_TIMER_H__ */
@@ -0,0 +1,862 @@
+/**
+ * @file soft_timer_test.c
+ *
+ * @brief Regression tests of the software timer over the virtual-time
+ * hardware layer.
+ *
+ * Every test drives the virtual clock by hand, so the interrupts run at
+ * known times and the results are the same on every run. The tests are
+ * built with the flags of the library under test:
+ *
+ *   make test [POSTED=1] [SHARDED=1] [CHANNELS=2] ...
+ *
+ * One line is printed per failed check, and the exit status is the number
+ * of failed tests. With SOFT_TIMER_TRACE, the trace of test_trace() is
+ * written to the file given as argument, if any.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "soft_timer.h"
+#include "hmcu_timer.h"
+#include "hmcu_timer_sim.h"
+
+/*****************************************************************************
+ * Private macros.
+ *****************************************************************************/
+#define TEST_CHECK(condition) \
+		test_check((condition), #condition, __func__, __LINE__)
+
+/*****************************************************************************
+ * Private constants.
+ *****************************************************************************/
+#define TEST_TIMERS				8
+
+/*****************************************************************************
+ * Global variables.
+ *****************************************************************************/
+static soft_timer			test_timers[TEST_TIMERS];
+static uint32_t				test_fires[TEST_TIMERS];
+static uint64_t				test_fired_us[TEST_TIMERS];
+static uint64_t				test_due_us[TEST_TIMERS];
+static uint32_t				test_order[TEST_TIMERS];
+static uint32_t				test_order_qty;
+static int64_t				test_early_max_us;
+static uint32_t				test_spend_us;
+static uint32_t				test_random_state;
+static bool					test_failed;
+#if (SOFT_TIMER_TRACE)
+static soft_timer_trace_record_t	test_records[SOFT_TIMER_TRACE_SIZE];
+static FILE *				test_trace_file;
+#endif
+
+/*****************************************************************************
+ * Bodies of private functions.
+ *****************************************************************************/
+
+static void test_check(bool condition, const char * text,
+					   const char * test, int line){
+
+	if(!condition){
+		printf("%s:%d: check failed: %s\n", test, line, text);
+		test_failed = true;
+	}
+}
+
+static void test_callback(soft_timer_t *p_timer){
+
+	ptrdiff_t i = p_timer - test_timers;
+
+	/* Keep how early the timer fired, if it was due later. */
+	test_fires[i]++;
+	test_order[i] = test_order_qty++;
+	test_fired_us[i] = hmcu_sim_now();
+	if((int64_t)(test_due_us[i] - test_fired_us[i]) > test_early_max_us){
+		test_early_max_us = (int64_t)(test_due_us[i] - test_fired_us[i]);
+	}
+}
+
+#if (SOFT_TIMER_STATS)
+static void test_spendCallback(soft_timer_t *p_timer){
+
+	/* Take a known time, by moving the virtual clock. No other timer runs,
+	 * so no interrupt is run meanwhile. */
+	test_callback(p_timer);
+	hmcu_sim_runUntil(hmcu_sim_now() + test_spend_us);
+}
+#endif
+
+static uint32_t test_random(uint32_t range){
+
+	/* Linear congruential generator, so every host runs the same test. */
+	test_random_state = test_random_state*1103515245u + 12345u;
+	return (test_random_state >> 8) % range;
+}
+
+static void test_run(uint32_t time_ms){
+
+	/* Run the interrupts due meanwhile. In deferred mode the callbacks they
+	 * left at the dispatch ring run every millisecond, so they are late by
+	 * less than one millisecond. */
+#if (SOFT_TIMER_DEFERRED)
+	while(time_ms-- > 0){
+		hmcu_sim_runUntil(hmcu_sim_now() + 1000u);
+		soft_timer_dispatch();
+	}
+#else
+	hmcu_sim_runUntil(hmcu_sim_now() + (uint64_t)time_ms*1000u);
+#endif
+}
+
+static void test_setUp(void){
+
+	uint8_t i;
+
+	soft_timer_init();
+#if (SOFT_TIMER_SHARDED)
+	soft_timer_shard_attach(0);
+#endif
+	for(i = 0 ; i < TEST_TIMERS; i++){
+		soft_timer_create(&test_timers[i]);
+		soft_timer_set(&test_timers[i], test_callback, 10, false);
+		test_fires[i] = 0;
+		test_fired_us[i] = 0;
+		test_due_us[i] = 0;
+		test_order[i] = 0;
+	}
+	test_order_qty = 0;
+	test_spend_us = 0;
+	test_early_max_us = 0;
+	test_random_state = 1;
+}
+
+static void test_setChannel0(uint8_t i){
+
+	/* Put the timer at the channel 0, so its registers are the ones
+	 * counted. In sharded mode the timers of the shard 0 are there
+	 * already. */
+#if (SOFT_TIMER_SHARDED)
+	(void)i;
+#else
+	TEST_CHECK(soft_timer_set_channel(&test_timers[i], 0) ==
+			   SOFT_TIMER_STATUS_SUCCESS);
+#endif
+}
+
+/* A timer started once the queue of its channel drained has to fire. In
+ * posted mode the start only triggers the interrupt of the channel, which
+ * has to be enabled again when the queue empties. */
+static void test_startAfterDrain(void){
+
+	test_setUp();
+
+	TEST_CHECK(soft_timer_start(&test_timers[0]) == SOFT_TIMER_STATUS_SUCCESS);
+	test_run(20);
+	TEST_CHECK(test_fires[0] == 1);
+
+	TEST_CHECK(soft_timer_start(&test_timers[1]) == SOFT_TIMER_STATUS_SUCCESS);
+	TEST_CHECK(hmcu_sim_pendingIRQs() == 0);
+	test_run(100);
+	TEST_CHECK(test_fires[1] == 1);
+
+	TEST_CHECK(soft_timer_start(&test_timers[0]) == SOFT_TIMER_STATUS_SUCCESS);
+	test_run(100);
+	TEST_CHECK(test_fires[0] == 2);
+}
+
+/* A timer never fires before its timeout, even when it is started between
+ * two counts of the hardware timer, while others keep it counting. */
+static void test_neverEarly(void){
+
+	uint32_t i, k, timeout_us;
+
+	test_setUp();
+
+	for(k = 0 ; k < 20000; k++){
+		i = test_random(TEST_TIMERS);
+		switch(test_random(3)){
+		case 0:
+			/* A posted start of a running timer would be dropped, so the
+			 * timer is stopped first. */
+			timeout_us = 1 + test_random(test_random(4) ? 3000000 : 20000);
+			soft_timer_stop(&test_timers[i]);
+			if((soft_timer_set_us(&test_timers[i], test_callback, timeout_us,
+								  false) == SOFT_TIMER_STATUS_SUCCESS) &&
+			   (soft_timer_start(&test_timers[i]) ==
+					SOFT_TIMER_STATUS_SUCCESS)){
+				test_due_us[i] = hmcu_sim_now() + timeout_us;
+			}
+			break;
+		case 1:
+			soft_timer_stop(&test_timers[i]);
+			break;
+		default:
+			hmcu_sim_runUntil(hmcu_sim_now() + test_random(5000));
+#if (SOFT_TIMER_DEFERRED)
+			soft_timer_dispatch();
+#endif
+			break;
+		}
+	}
+	test_run(4000);
+
+	TEST_CHECK(test_early_max_us <= 0);
+}
+
+/* A new setting of a running timer keeps its deadline, and is used from its
+ * next start on. In posted mode it is applied by the interrupt, in order
+ * with the commands posted after it, even when it moves the timer to
+ * another channel. */
+static void test_setWhileRunning(void){
+
+	uint8_t k;
+
+	test_setUp();
+
+	TEST_CHECK(soft_timer_start(&test_timers[0]) == SOFT_TIMER_STATUS_SUCCESS);
+	TEST_CHECK(soft_timer_set(&test_timers[0], test_callback, 30, false) ==
+			   SOFT_TIMER_STATUS_SUCCESS);
+	test_run(20);
+	TEST_CHECK(test_fires[0] == 1);
+
+	TEST_CHECK(soft_timer_start(&test_timers[0]) == SOFT_TIMER_STATUS_SUCCESS);
+	test_run(20);
+	TEST_CHECK(test_fires[0] == 1);
+	test_run(20);
+	TEST_CHECK(test_fires[0] == 2);
+
+	/* A short period takes the channel 0, when there are several. Every
+	 * period is dispatched before the next one. */
+	TEST_CHECK(soft_timer_set_us(&test_timers[1], test_callback, 1000, true) ==
+			   SOFT_TIMER_STATUS_SUCCESS);
+	TEST_CHECK(soft_timer_start(&test_timers[1]) == SOFT_TIMER_STATUS_SUCCESS);
+	for(k = 0 ; k < 10; k++){
+		test_run(1);
+	}
+	TEST_CHECK(test_fires[1] >= 9);
+	TEST_CHECK(soft_timer_stop(&test_timers[1]) == SOFT_TIMER_STATUS_SUCCESS);
+	test_run(10);
+	TEST_CHECK(test_fires[1] <= 10);
+}
+
+/* A timer restarted after more than 2^31 us of idle fires once, at its
+ * timeout. With the monotonic time base the low 32 bits of the counter
+ * look earlier than the time of the queue by then, which must still
+ * follow the counter. */
+static void test_restartAfterLongIdle(void){
+
+	uint64_t irqs;
+
+	test_setUp();
+
+	TEST_CHECK(soft_timer_start(&test_timers[0]) == SOFT_TIMER_STATUS_SUCCESS);
+	test_run(20);
+	TEST_CHECK(test_fires[0] == 1);
+
+	/* Idle for 40 minutes. */
+	hmcu_sim_runUntil(hmcu_sim_now() + 2400000000u);
+
+	irqs = hmcu_sim_irqCount();
+	test_due_us[0] = hmcu_sim_now() + 10000u;
+	TEST_CHECK(soft_timer_restart(&test_timers[0]) ==
+			   SOFT_TIMER_STATUS_SUCCESS);
+	test_run(20);
+	TEST_CHECK(test_fires[0] == 2);
+	TEST_CHECK(test_fired_us[0] - test_due_us[0] <= 1000u);
+	TEST_CHECK(hmcu_sim_irqCount() - irqs < 10u);
+	TEST_CHECK(test_early_max_us <= 0);
+}
+
+/* A lone timer takes as few interrupts as the counter allows, with either
+ * engine: one per longest countdown. The slots of the timing wheel passed
+ * meanwhile take no interrupt of their own. */
+static void test_fewInterrupts(void){
+
+	uint64_t irqs;
+
+	test_setUp();
+
+	TEST_CHECK(soft_timer_set_us(&test_timers[0], test_callback, 987000,
+								 false) == SOFT_TIMER_STATUS_SUCCESS);
+	TEST_CHECK(soft_timer_start(&test_timers[0]) == SOFT_TIMER_STATUS_SUCCESS);
+	irqs = hmcu_sim_irqCount();
+	test_run(1000);
+	TEST_CHECK(test_fires[0] == 1);
+	TEST_CHECK(hmcu_sim_irqCount() - irqs ==
+			   (987000 + HMCU_SIM_SPAN_US - 1)/HMCU_SIM_SPAN_US);
+}
+
+/* A timeout longer than the counter crosses the slots of several levels of
+ * the timing wheel, 1 us wide and up. It still takes one interrupt per
+ * longest countdown, like with the heap. */
+static void test_longTimeout(void){
+
+	uint64_t irqs;
+
+	test_setUp();
+
+	TEST_CHECK(soft_timer_set_us(&test_timers[0], test_callback, 45678901,
+								 false) == SOFT_TIMER_STATUS_SUCCESS);
+	TEST_CHECK(soft_timer_start(&test_timers[0]) == SOFT_TIMER_STATUS_SUCCESS);
+	test_due_us[0] = hmcu_sim_now() + 45678901u;
+	irqs = hmcu_sim_irqCount();
+	test_run(46000);
+	TEST_CHECK(test_fires[0] == 1);
+	TEST_CHECK(test_early_max_us <= 0);
+	TEST_CHECK(hmcu_sim_irqCount() - irqs ==
+			   (45678901 + HMCU_SIM_SPAN_US - 1)/HMCU_SIM_SPAN_US);
+}
+
+/* A set of timers is started or stopped with the registers set once. In
+ * posted mode every command raises the interrupt, which sets them. */
+static void test_startStopMany(void){
+
+	soft_timer_t * const timers[] = {
+		&test_timers[0], &test_timers[1], &test_timers[2], &test_timers[3]
+	};
+	uint64_t sets;
+	uint8_t i;
+
+	test_setUp();
+	for(i = 0 ; i < 4; i++){
+		test_setChannel0(i);
+	}
+
+	sets = hmcu_sim_setCount();
+	TEST_CHECK(soft_timer_start_many(timers, 4) == SOFT_TIMER_STATUS_SUCCESS);
+	TEST_CHECK(SOFT_TIMER_POSTED || (hmcu_sim_setCount() - sets == 1));
+	test_run(20);
+	for(i = 0 ; i < 4; i++){
+		TEST_CHECK(test_fires[i] == 1);
+	}
+
+	TEST_CHECK(soft_timer_start_many(timers, 4) == SOFT_TIMER_STATUS_SUCCESS);
+	sets = hmcu_sim_setCount();
+	TEST_CHECK(soft_timer_stop_many(timers, 2) == SOFT_TIMER_STATUS_SUCCESS);
+	TEST_CHECK(SOFT_TIMER_POSTED || (hmcu_sim_setCount() - sets == 1));
+	test_run(20);
+	TEST_CHECK((test_fires[0] == 1) && (test_fires[1] == 1));
+	TEST_CHECK((test_fires[2] == 2) && (test_fires[3] == 2));
+	TEST_CHECK(hmcu_sim_pendingIRQs() == 0);
+}
+
+/* A transaction sets the registers once, at its outermost commit, and a
+ * timer that expired meanwhile still fires after it. A commit without a
+ * transaction open is refused. */
+static void test_transaction(void){
+
+	uint64_t sets;
+
+	test_setUp();
+	test_setChannel0(0);
+	test_setChannel0(1);
+	test_setChannel0(2);
+
+	TEST_CHECK(soft_timer_commit() == SOFT_TIMER_STATUS_INVALID_STATE);
+
+	/* The timer 0 expires while the transaction is open. */
+	test_due_us[0] = hmcu_sim_now() + 10000u;
+	TEST_CHECK(soft_timer_start(&test_timers[0]) == SOFT_TIMER_STATUS_SUCCESS);
+	test_run(8);
+
+	sets = hmcu_sim_setCount();
+	TEST_CHECK(soft_timer_begin() == SOFT_TIMER_STATUS_SUCCESS);
+	TEST_CHECK(soft_timer_start(&test_timers[1]) == SOFT_TIMER_STATUS_SUCCESS);
+	TEST_CHECK(soft_timer_begin() == SOFT_TIMER_STATUS_SUCCESS);
+	TEST_CHECK(soft_timer_start(&test_timers[2]) == SOFT_TIMER_STATUS_SUCCESS);
+	TEST_CHECK(soft_timer_commit() == SOFT_TIMER_STATUS_SUCCESS);
+	TEST_CHECK(SOFT_TIMER_POSTED || (hmcu_sim_setCount() == sets));
+	hmcu_sim_runUntil(hmcu_sim_now() + 5000u);
+	TEST_CHECK(soft_timer_commit() == SOFT_TIMER_STATUS_SUCCESS);
+	TEST_CHECK(SOFT_TIMER_POSTED || (hmcu_sim_setCount() - sets == 1));
+	TEST_CHECK(soft_timer_commit() == SOFT_TIMER_STATUS_INVALID_STATE);
+
+	test_run(20);
+	TEST_CHECK(test_fires[0] == 1);
+	TEST_CHECK(test_fires[1] == 1);
+	TEST_CHECK(test_fires[2] == 1);
+	TEST_CHECK(test_early_max_us <= 0);
+	TEST_CHECK(hmcu_sim_pendingIRQs() == 0);
+}
+
+/* A restart that pushes the deadline later only keeps it at the instance,
+ * and the timer fires at the new deadline, not at the old one. A restart
+ * to an earlier deadline sets the registers right away. */
+static void test_restart(void){
+
+	uint64_t sets;
+	uint8_t k;
+
+	test_setUp();
+	test_setChannel0(0);
+
+	TEST_CHECK(soft_timer_start(&test_timers[0]) == SOFT_TIMER_STATUS_SUCCESS);
+	for(k = 0 ; k < 5; k++){
+		test_run(5);
+		sets = hmcu_sim_setCount();
+		test_due_us[0] = hmcu_sim_now() + 10000u;
+		TEST_CHECK(soft_timer_restart(&test_timers[0]) ==
+				   SOFT_TIMER_STATUS_SUCCESS);
+		TEST_CHECK(SOFT_TIMER_POSTED || (hmcu_sim_setCount() == sets));
+	}
+	TEST_CHECK(test_fires[0] == 0);
+	test_run(9);
+	TEST_CHECK(test_fires[0] == 0);
+	test_run(2);
+	TEST_CHECK(test_fires[0] == 1);
+	TEST_CHECK(test_early_max_us <= 0);
+
+	/* A shorter timeout is used from the restart on. */
+	TEST_CHECK(soft_timer_set(&test_timers[0], test_callback, 30, false) ==
+			   SOFT_TIMER_STATUS_SUCCESS);
+	TEST_CHECK(soft_timer_start(&test_timers[0]) == SOFT_TIMER_STATUS_SUCCESS);
+	test_run(5);
+	TEST_CHECK(soft_timer_set(&test_timers[0], test_callback, 5, false) ==
+			   SOFT_TIMER_STATUS_SUCCESS);
+	sets = hmcu_sim_setCount();
+	test_due_us[0] = hmcu_sim_now() + 5000u;
+	TEST_CHECK(soft_timer_restart(&test_timers[0]) ==
+			   SOFT_TIMER_STATUS_SUCCESS);
+	TEST_CHECK(SOFT_TIMER_POSTED || (hmcu_sim_setCount() - sets == 1));
+	test_run(6);
+	TEST_CHECK(test_fires[0] == 2);
+	TEST_CHECK(test_early_max_us <= 0);
+	test_run(30);
+	TEST_CHECK(test_fires[0] == 2);
+}
+
+/* Timers whose windows overlap share one interrupt, and each fires
+ * neither before its timeout nor after its timeout plus its tolerance. A
+ * tolerance of 16 ms puts their deadlines on a grid of 8192 us. The grid
+ * point reached by a first timer is taken as the start, so the windows
+ * share the next grid point. */
+static void test_tolerance(void){
+
+	uint64_t irqs;
+	uint8_t i;
+
+	test_setUp();
+	for(i = 0 ; i < 4; i++){
+		test_setChannel0(i);
+		TEST_CHECK(soft_timer_set_tolerance(&test_timers[i], 16) ==
+				   SOFT_TIMER_STATUS_SUCCESS);
+	}
+	TEST_CHECK(soft_timer_set_us(&test_timers[0], test_callback, 1000,
+								 false) == SOFT_TIMER_STATUS_SUCCESS);
+	TEST_CHECK(soft_timer_start(&test_timers[0]) == SOFT_TIMER_STATUS_SUCCESS);
+	TEST_CHECK(hmcu_sim_step());
+
+	for(i = 1 ; i < 4; i++){
+		TEST_CHECK(soft_timer_set_us(&test_timers[i], test_callback,
+									 18000u + i*2000u, false) ==
+				   SOFT_TIMER_STATUS_SUCCESS);
+		test_due_us[i] = hmcu_sim_now() + 18000u + i*2000u;
+		TEST_CHECK(soft_timer_start(&test_timers[i]) ==
+				   SOFT_TIMER_STATUS_SUCCESS);
+	}
+	irqs = hmcu_sim_irqCount();
+	test_run(50);
+	TEST_CHECK(hmcu_sim_irqCount() - irqs == 1);
+	TEST_CHECK(test_early_max_us <= 0);
+	for(i = 1 ; i < 4; i++){
+		TEST_CHECK(test_fires[i] == 1);
+		TEST_CHECK(test_fired_us[i] == test_fired_us[1]);
+		TEST_CHECK(test_fired_us[i] - test_due_us[i] <= 16000u);
+	}
+}
+
+/* The time to the next interrupt is the time to the earliest deadline, and
+ * reading it leaves the hardware timer counting. The idle loop sleeps until
+ * that deadline, and returns right away with no timer running. */
+static void test_nextDeadline(void){
+
+	uint64_t expiry, sets, now;
+
+	test_setUp();
+	test_setChannel0(0);
+	test_setChannel0(1);
+	TEST_CHECK(soft_timer_next_deadline() == UINT32_MAX);
+	now = hmcu_sim_now();
+	soft_timer_idle();
+	TEST_CHECK(hmcu_sim_now() == now);
+
+	TEST_CHECK(soft_timer_set(&test_timers[1], test_callback, 30, false) ==
+			   SOFT_TIMER_STATUS_SUCCESS);
+	TEST_CHECK(soft_timer_start(&test_timers[1]) == SOFT_TIMER_STATUS_SUCCESS);
+	test_due_us[0] = hmcu_sim_now() + 10000u;
+	TEST_CHECK(soft_timer_start(&test_timers[0]) == SOFT_TIMER_STATUS_SUCCESS);
+	test_run(3);
+
+	/* Without the monotonic time base, the time read drops the part of a
+	 * count and the countdown is rounded up, so the deadline may be up to
+	 * three counts of the prescaler later. */
+	expiry = hmcu_sim_nextExpiry();
+	sets = hmcu_sim_setCount();
+	TEST_CHECK(soft_timer_next_deadline() ==
+			   (uint32_t)(expiry - hmcu_sim_now()));
+	TEST_CHECK(soft_timer_next_deadline() >= 7000u);
+	TEST_CHECK(soft_timer_next_deadline() <=
+			   7000u + 3u*_hmcu_readPrescaler(0));
+	TEST_CHECK(hmcu_sim_nextExpiry() == expiry);
+	TEST_CHECK(hmcu_sim_setCount() == sets);
+	TEST_CHECK(test_fires[0] == 0);
+
+	soft_timer_idle();
+	TEST_CHECK(hmcu_sim_now() == expiry);
+#if (SOFT_TIMER_DEFERRED)
+	/* The expiry waits at the dispatch ring, which is work to do. */
+	TEST_CHECK(soft_timer_next_deadline() == 0);
+	soft_timer_idle();
+	TEST_CHECK(hmcu_sim_now() == expiry);
+	soft_timer_dispatch();
+#endif
+	TEST_CHECK(test_fires[0] == 1);
+	TEST_CHECK(test_early_max_us <= 0);
+	TEST_CHECK(soft_timer_next_deadline() ==
+			   (uint32_t)(hmcu_sim_nextExpiry() - hmcu_sim_now()));
+}
+
+#if (SOFT_TIMER_STATS)
+/* The counters of a timer and of the interrupts follow a known schedule:
+ * callbacks of 0, 1, 2, 3, 700 and 5000 us, and an interrupt held off for
+ * 2 ms. Without the monotonic time base the time of the queue does not
+ * count the time the interrupt was held off, so no lateness is seen. */
+static void test_stats(void){
+
+	const uint32_t spends[] = {0, 1, 2, 3, 700, 5000};
+	soft_timer_stats_t stats;
+	soft_timer_irq_stats_t irq_stats;
+	uint32_t late_us = (SOFT_TIMER_MONOTONIC) ? 2000u : 0u;
+	uint8_t i;
+
+	test_setUp();
+	test_setChannel0(0);
+	TEST_CHECK(soft_timer_set_us(&test_timers[0], test_spendCallback, 5000,
+								 false) == SOFT_TIMER_STATUS_SUCCESS);
+	for(i = 0 ; i < sizeof(spends)/sizeof(spends[0]); i++){
+		test_spend_us = spends[i];
+		TEST_CHECK(soft_timer_start(&test_timers[0]) ==
+				   SOFT_TIMER_STATUS_SUCCESS);
+		test_run(20);
+	}
+
+	/* Hold the interrupt off for 2 ms after the deadline. */
+	test_spend_us = 0;
+	TEST_CHECK(soft_timer_start(&test_timers[0]) == SOFT_TIMER_STATUS_SUCCESS);
+	_hmcu_disableIRQ(0);
+	hmcu_sim_runUntil(hmcu_sim_now() + 7000u);
+	_hmcu_enableIRQ(0);
+	test_run(1);
+
+	TEST_CHECK(soft_timer_get_stats(&test_timers[0], &stats) ==
+			   SOFT_TIMER_STATUS_SUCCESS);
+	TEST_CHECK(stats.fires == 7);
+	TEST_CHECK(stats.late_max_us == late_us);
+	TEST_CHECK(stats.late_mean_us == late_us/7);
+	TEST_CHECK(stats.run_max_us == 5000);
+	/* The buckets are [0, 1), [1, 2), [2, 4), ... [512, 1024) is the
+	 * bucket 10, and the last one takes 5000 us. */
+	TEST_CHECK(stats.run_hist[0] == 2);
+	TEST_CHECK(stats.run_hist[1] == 1);
+	TEST_CHECK(stats.run_hist[2] == 2);
+	TEST_CHECK(stats.run_hist[10] == 1);
+	TEST_CHECK(stats.run_hist[SOFT_TIMER_STATS_BUCKETS - 1] == 1);
+
+	/* The interrupts are counted at the virtual-time port too. The counts
+	 * set by soft_timer_init() at every channel are not settings of the
+	 * registers. In deferred mode the callbacks take no interrupt time. */
+	soft_timer_get_irq_stats(&irq_stats);
+	TEST_CHECK(irq_stats.irqs == hmcu_sim_irqCount());
+	TEST_CHECK(irq_stats.reprograms ==
+			   hmcu_sim_setCount() - SOFT_TIMER_CHANNELS);
+	TEST_CHECK(irq_stats.irq_max_us == ((SOFT_TIMER_DEFERRED) ? 0 : 5000));
+	TEST_CHECK(irq_stats.irq_us == ((SOFT_TIMER_DEFERRED) ? 0 : 5706));
+}
+#endif
+
+#if (SOFT_TIMER_TRACE)
+static void test_dumpTrace(uint32_t * p_expiries, uint32_t * p_late_max_us){
+
+	uint32_t count, i;
+
+	/* Copy the records, check they follow each other, and count the
+	 * expiries and their worst lateness. With a file given to the tests,
+	 * the records are appended to it, as the decoder reads them. */
+	count = soft_timer_trace_dump(test_records, SOFT_TIMER_TRACE_SIZE);
+	TEST_CHECK(count != 0);
+	*p_expiries = 0;
+	*p_late_max_us = 0;
+	for(i = 0 ; i < count; i++){
+		if(i != 0){
+			TEST_CHECK(test_records[i].sequence ==
+					   (uint16_t)(test_records[i-1].sequence + 1));
+		}
+		if(test_records[i].event == SOFT_TIMER_TRACE_EXPIRE){
+			(*p_expiries)++;
+			if(test_records[i].value > *p_late_max_us){
+				*p_late_max_us = test_records[i].value;
+			}
+		}
+	}
+	if(test_trace_file != NULL){
+		TEST_CHECK(fwrite(test_records, sizeof(test_records[0]), count,
+						  test_trace_file) == count);
+	}
+}
+
+/* The trace records a known schedule: the setup, four timers expiring on
+ * time, one whose interrupt is held off for 2 ms, a restart and a stop.
+ * A period of 1 ms run for 300 ms then overwrites the oldest records of
+ * the ring. Both dumps are written to the file given, and make test-trace
+ * checks the summary of the decoder against tests/trace_expected.txt: the
+ * records dropped between the dumps show as lost ones. */
+static void test_trace(void){
+
+	uint32_t expiries, late_max_us;
+	uint8_t i;
+
+	test_setUp();
+	for(i = 0 ; i < 8; i++){
+		test_setChannel0(i);
+	}
+
+	for(i = 0 ; i < 4; i++){
+		TEST_CHECK(soft_timer_start(&test_timers[i]) ==
+				   SOFT_TIMER_STATUS_SUCCESS);
+	}
+	test_run(20);
+
+	TEST_CHECK(soft_timer_start(&test_timers[4]) == SOFT_TIMER_STATUS_SUCCESS);
+	_hmcu_disableIRQ(0);
+	hmcu_sim_runUntil(hmcu_sim_now() + 12000u);
+	_hmcu_enableIRQ(0);
+	test_run(1);
+
+	TEST_CHECK(soft_timer_start(&test_timers[5]) == SOFT_TIMER_STATUS_SUCCESS);
+	test_run(5);
+	TEST_CHECK(soft_timer_restart(&test_timers[5]) ==
+			   SOFT_TIMER_STATUS_SUCCESS);
+	test_run(20);
+	TEST_CHECK(soft_timer_start(&test_timers[6]) == SOFT_TIMER_STATUS_SUCCESS);
+	TEST_CHECK(soft_timer_stop(&test_timers[6]) == SOFT_TIMER_STATUS_SUCCESS);
+
+	test_dumpTrace(&expiries, &late_max_us);
+	TEST_CHECK(expiries == 6);
+	TEST_CHECK(late_max_us == ((SOFT_TIMER_MONOTONIC) ? 2000u : 0u));
+
+	TEST_CHECK(soft_timer_set_us(&test_timers[7], test_callback, 1000, true) ==
+			   SOFT_TIMER_STATUS_SUCCESS);
+	TEST_CHECK(soft_timer_start(&test_timers[7]) == SOFT_TIMER_STATUS_SUCCESS);
+	test_run(300);
+	TEST_CHECK(soft_timer_stop(&test_timers[7]) == SOFT_TIMER_STATUS_SUCCESS);
+
+	test_dumpTrace(&expiries, &late_max_us);
+	TEST_CHECK(expiries != 0);
+}
+#endif
+
+#if (SOFT_TIMER_DEFERRED)
+/* In deferred mode the callbacks only run from soft_timer_dispatch(), in
+ * the order the timers expired. An expiry of a timer whose previous one
+ * was not dispatched yet is lost, and counted. */
+static void test_dispatch(void){
+
+	soft_timer_pool_stats_t stats;
+	uint8_t i, count;
+
+	/* Expire as many timers as the ring takes, the latest started first. */
+	test_setUp();
+	count = (SOFT_TIMER_DISPATCH_RING_SIZE < TEST_TIMERS) ?
+			SOFT_TIMER_DISPATCH_RING_SIZE : TEST_TIMERS;
+	for(i = 0 ; i < count; i++){
+		test_setChannel0(i);
+		TEST_CHECK(soft_timer_set_us(&test_timers[i], test_callback,
+									 (uint32_t)(count - i)*1000u,
+									 false) == SOFT_TIMER_STATUS_SUCCESS);
+		TEST_CHECK(soft_timer_start(&test_timers[i]) ==
+				   SOFT_TIMER_STATUS_SUCCESS);
+	}
+	hmcu_sim_runUntil(hmcu_sim_now() + 20000u);
+	for(i = 0 ; i < count; i++){
+		TEST_CHECK(test_fires[i] == 0);
+	}
+
+	TEST_CHECK(soft_timer_dispatch() == count);
+	for(i = 0 ; i < count; i++){
+		TEST_CHECK(test_fires[i] == 1);
+		TEST_CHECK(test_order[i] == (uint32_t)(count - 1 - i));
+	}
+	TEST_CHECK(soft_timer_dispatch() == 0);
+
+	/* A period of 1 ms left for 10 ms runs once, and loses nine expiries. */
+	soft_timer_get_pool_stats(&stats);
+	TEST_CHECK(stats.dispatch_lost == 0);
+	TEST_CHECK(soft_timer_set_us(&test_timers[0], test_callback, 1000,
+								 true) == SOFT_TIMER_STATUS_SUCCESS);
+	TEST_CHECK(soft_timer_start(&test_timers[0]) == SOFT_TIMER_STATUS_SUCCESS);
+	hmcu_sim_runUntil(hmcu_sim_now() + 10500u);
+	TEST_CHECK(soft_timer_stop(&test_timers[0]) == SOFT_TIMER_STATUS_SUCCESS);
+	TEST_CHECK(soft_timer_dispatch() == 1);
+	TEST_CHECK(test_fires[0] == 2);
+	soft_timer_get_pool_stats(&stats);
+	TEST_CHECK(stats.dispatch_lost == 9);
+}
+
+#if (SOFT_TIMER_DISPATCH_RING_SIZE < TEST_TIMERS)
+/* The expiries that find the dispatch ring full are lost, and counted. The
+ * ones already at the ring still run, and the ring takes new ones once it
+ * is dispatched. */
+static void test_dispatchRingFull(void){
+
+	soft_timer_pool_stats_t stats;
+	uint8_t i, lost;
+
+	test_setUp();
+	for(i = 0 ; i < TEST_TIMERS; i++){
+		test_setChannel0(i);
+		TEST_CHECK(soft_timer_start(&test_timers[i]) ==
+				   SOFT_TIMER_STATUS_SUCCESS);
+	}
+	hmcu_sim_runUntil(hmcu_sim_now() + 20000u);
+
+	TEST_CHECK(soft_timer_dispatch() == SOFT_TIMER_DISPATCH_RING_SIZE);
+	soft_timer_get_pool_stats(&stats);
+	TEST_CHECK(stats.dispatch_lost ==
+			   TEST_TIMERS - SOFT_TIMER_DISPATCH_RING_SIZE);
+	lost = 0;
+	for(i = 0 ; i < TEST_TIMERS; i++){
+		if(test_fires[i] == 0){
+			lost = i;
+		}
+	}
+	TEST_CHECK(test_fires[lost] == 0);
+
+	TEST_CHECK(soft_timer_start(&test_timers[lost]) ==
+			   SOFT_TIMER_STATUS_SUCCESS);
+	test_run(20);
+	TEST_CHECK(test_fires[lost] == 1);
+}
+#endif
+#endif
+
+#if (SOFT_TIMER_POSTED)
+/* In posted mode a new tolerance of a timer already set is applied by the
+ * interrupt of its channel, like a new setting, and used from the next
+ * start on. */
+static void test_postedTolerance(void){
+
+	uint64_t irqs;
+
+	test_setUp();
+
+	irqs = hmcu_sim_irqCount();
+	TEST_CHECK(soft_timer_set_tolerance(&test_timers[0], 8) ==
+			   SOFT_TIMER_STATUS_SUCCESS);
+	TEST_CHECK(hmcu_sim_irqCount() - irqs == 1);
+	TEST_CHECK(hmcu_sim_pendingIRQs() == 0);
+
+	test_due_us[0] = hmcu_sim_now() + 10000u;
+	TEST_CHECK(soft_timer_start(&test_timers[0]) == SOFT_TIMER_STATUS_SUCCESS);
+	test_run(30);
+	TEST_CHECK(test_fires[0] == 1);
+	TEST_CHECK(test_early_max_us <= 0);
+	TEST_CHECK(test_fired_us[0] - test_due_us[0] <= 8000u);
+}
+#endif
+
+#if (SOFT_TIMER_SHARDED)
+/* A start posted by another shard at a shard whose queue drained has to be
+ * applied, so the interrupt of the shard has to stay enabled. */
+static void test_startFromOtherShard(void){
+
+	/* Move the timer to the shard 1. */
+	test_setUp();
+	soft_timer_destroy(&test_timers[0]);
+	soft_timer_shard_attach(1);
+	soft_timer_create(&test_timers[0]);
+	soft_timer_set(&test_timers[0], test_callback, 10, false);
+
+	TEST_CHECK(soft_timer_start(&test_timers[0]) == SOFT_TIMER_STATUS_SUCCESS);
+	test_run(20);
+	TEST_CHECK(test_fires[0] == 1);
+
+	soft_timer_shard_attach(0);
+	TEST_CHECK(soft_timer_start(&test_timers[0]) == SOFT_TIMER_STATUS_SUCCESS);
+	TEST_CHECK(hmcu_sim_pendingIRQs() == 0);
+
+	/* The shard 1 dispatches its own timers. */
+	soft_timer_shard_attach(1);
+	test_run(20);
+	TEST_CHECK(test_fires[0] == 2);
+}
+#endif
+
+int main(int argc, char **argv){
+
+	int failed = 0;
+	void (* const tests[])(void) = {
+		test_startAfterDrain,
+		test_neverEarly,
+		test_setWhileRunning,
+		test_restartAfterLongIdle,
+		test_fewInterrupts,
+		test_longTimeout,
+		test_startStopMany,
+		test_transaction,
+		test_restart,
+		test_tolerance,
+		test_nextDeadline,
+#if (SOFT_TIMER_STATS)
+		test_stats,
+#endif
+#if (SOFT_TIMER_TRACE)
+		test_trace,
+#endif
+#if (SOFT_TIMER_DEFERRED)
+		test_dispatch,
+#if (SOFT_TIMER_DISPATCH_RING_SIZE < TEST_TIMERS)
+		test_dispatchRingFull,
+#endif
+#endif
+#if (SOFT_TIMER_POSTED)
+		test_postedTolerance,
+#endif
+#if (SOFT_TIMER_SHARDED)
+		test_startFromOtherShard,
+#endif
+	};
+	size_t i;
+
+#if (SOFT_TIMER_TRACE)
+	if(argc > 1){
+		test_trace_file = fopen(argv[1], "wb");
+		if(test_trace_file == NULL){
+			perror(argv[1]);
+			return 1;
+		}
+	}
+#else
+	(void)argc;
+	(void)argv;
+#endif
+
+	for(i = 0 ; i < sizeof(tests)/sizeof(tests[0]); i++){
+		test_failed = false;
+		tests[i]();
+		if(test_failed){
+			failed++;
+		}
+	}
+
+#if (SOFT_TIMER_TRACE)
+	if(test_trace_file != NULL){
+		fclose(test_trace_file);
+	}
+#endif
+
+	printf("%u tests, %d failed\n", (unsigned)i, failed);
+	return failed;
+}
@@ -0,0 +1,224 @@
+/**
+ * @file soft_timer_replay.c
+ *
+ * @brief Replay of a recorded timer trace over the virtual-time hardware
+ * layer.
+ *
+ * The trace is a text file with one event per line, sorted by time, and
+ * lines starting with '#' are ignored:
+ *
+ *   <time_us> start <id> <reload_ms> <repeat> [tolerance_ms]
+ *   <time_us> stop <id>
+ *
+ * Every start sets the timer with the given reload, repeat flag and
+ * tolerance, and starts it. The virtual clock jumps from event to event and
+ * from expiry to expiry, so the replay takes as long as the engine work, and
+ * the results are the same on every run. In deferred mode the callbacks are
+ * dispatched after every interrupt. At the end one line of key=value pairs is
+ * printed, to compare scheduling changes against each other:
+ *
+ *   soft_timer_replay trace.txt [extra_ms]
+ *
+ * extra_ms keeps the simulation running after the last event. Without a
+ * file name, or with "-", the trace is read from the standard input.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "soft_timer.h"
+#include "hmcu_timer_sim.h"
+
+/*****************************************************************************
+ * Private types.
+ *****************************************************************************/
+typedef struct replay_timer{
+	soft_timer				timer;
+	uint64_t				expected_us;
+	uint32_t				reload_ms;
+	bool					repeat;
+}replay_timer;
+
+/*****************************************************************************
+ * Global variables.
+ *****************************************************************************/
+static replay_timer			** replay_timers = NULL;
+static uint32_t				replay_timers_qty = 0;
+static uint64_t				replay_fires = 0;
+static int64_t				replay_late_sum_us = 0;
+static int64_t				replay_late_max_us = 0;
+static int64_t				replay_early_max_us = 0;
+
+/*****************************************************************************
+ * Bodies of private functions.
+ *****************************************************************************/
+
+static void replay_callback(soft_timer_t *p_timer){
+
+	replay_timer * tmp_ptr = (replay_timer *)p_timer;
+	int64_t late_us;
+
+	/* Account how late, or early, the timer fired. A repeating timer is
+	 * expected again one period after its ideal time, so a time base that
+	 * drifts shows as a lateness that keeps growing. */
+	late_us = (int64_t)(hmcu_sim_now() - tmp_ptr->expected_us);
+	replay_late_sum_us += late_us;
+	if(late_us > replay_late_max_us){
+		replay_late_max_us = late_us;
+	}
+	if(-late_us > replay_early_max_us){
+		replay_early_max_us = -late_us;
+	}
+	replay_fires++;
+	tmp_ptr->expected_us += (uint64_t)tmp_ptr->reload_ms*1000u;
+}
+
+static replay_timer * replay_timerAt(uint32_t id){
+
+	uint32_t qty;
+	replay_timer ** tmp_table;
+
+	/* Grow the table of timers up to the id. Each timer is allocated on its
+	 * own, since the software timer keeps its address. */
+	if(id >= replay_timers_qty){
+		qty = (id + 1 > 2*replay_timers_qty) ? id + 1 : 2*replay_timers_qty;
+		tmp_table = realloc(replay_timers, qty*sizeof(replay_timer *));
+		if(tmp_table == NULL){
+			return NULL;
+		}
+		memset(&tmp_table[replay_timers_qty], 0,
+			   (qty - replay_timers_qty)*sizeof(replay_timer *));
+		replay_timers = tmp_table;
+		replay_timers_qty = qty;
+	}
+	if(replay_timers[id] == NULL){
+		replay_timers[id] = calloc(1, sizeof(replay_timer));
+		if(replay_timers[id] != NULL){
+			soft_timer_create(&replay_timers[id]->timer);
+		}
+	}
+	return replay_timers[id];
+}
+
+static void replay_runUntil(uint64_t time_us){
+
+	/* Run every expiry up to the given time. In deferred mode the callbacks
+	 * left at the dispatch ring by each interrupt run right after it, so
+	 * they are timed like the ones run by the interrupt itself. */
+#if (SOFT_TIMER_DEFERRED)
+	while(hmcu_sim_nextExpiry() <= time_us){
+		hmcu_sim_step();
+		soft_timer_dispatch();
+	}
+#endif
+	hmcu_sim_runUntil(time_us);
+}
+
+static double replay_milliseconds(void){
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec*1e3 + (double)ts.tv_nsec/1e6;
+}
+
+int main(int argc, char **argv){
+
+	FILE * trace = stdin;
+	char line[256], op[16];
+	unsigned long long time_us;
+	unsigned long id, reload_ms, tolerance_ms, extra_ms = 0;
+	int repeat, fields;
+	uint64_t events = 0, rejected = 0;
+	replay_timer * tmp_ptr;
+	double t0;
+
+	if((argc > 1) && (strcmp(argv[1], "-") != 0)){
+		trace = fopen(argv[1], "r");
+		if(trace == NULL){
+			perror(argv[1]);
+			return 1;
+		}
+	}
+	if(argc > 2){
+		extra_ms = strtoul(argv[2], NULL, 10);
+	}
+
+	soft_timer_init();
+	t0 = replay_milliseconds();
+
+	while(fgets(line, sizeof(line), trace) != NULL){
+
+		if(line[0] == '#'){
+			continue;
+		}
+		tolerance_ms = 0;
+		fields = sscanf(line, "%llu %15s %lu %lu %d %lu", &time_us, op, &id,
+						&reload_ms, &repeat, &tolerance_ms);
+		if(fields < 3){
+			continue;
+		}
+
+		/* Run every expiry up to the event, then apply it. */
+		replay_runUntil(time_us);
+		tmp_ptr = replay_timerAt((uint32_t)id);
+		if(tmp_ptr == NULL){
+			rejected++;
+			continue;
+		}
+		events++;
+
+		if((strcmp(op, "start") == 0) && (fields >= 5)){
+
+			/* Only what the software timer accepted is expected. A new
+			 * setting of a running timer is used from its next timeout on,
+			 * and its deadline is only moved by a start. */
+			if(soft_timer_set(&tmp_ptr->timer, replay_callback,
+							  (uint32_t)reload_ms, repeat != 0)
+					== SOFT_TIMER_STATUS_SUCCESS){
+				tmp_ptr->reload_ms = (uint32_t)reload_ms;
+				tmp_ptr->repeat = (repeat != 0);
+			}
+			if((soft_timer_set_tolerance(&tmp_ptr->timer,
+										 (uint32_t)tolerance_ms)
+					== SOFT_TIMER_STATUS_SUCCESS) &&
+			   (soft_timer_start(&tmp_ptr->timer)
+					== SOFT_TIMER_STATUS_SUCCESS)){
+				tmp_ptr->expected_us = time_us +
+									   (uint64_t)tmp_ptr->reload_ms*1000u;
+			}else{
+				rejected++;
+			}
+		}else if(strcmp(op, "stop") == 0){
+			if(soft_timer_stop(&tmp_ptr->timer) != SOFT_TIMER_STATUS_SUCCESS){
+				rejected++;
+			}
+		}else{
+			rejected++;
+		}
+	}
+
+	replay_runUntil(hmcu_sim_now() + (uint64_t)extra_ms*1000u);
+
+	printf("events=%llu rejected=%llu fires=%llu interrupts=%llu "
+		   "late_mean_us=%.1f late_max_us=%lld early_max_us=%lld "
+		   "virtual_ms=%llu wall_ms=%.1f\n",
+		   (unsigned long long)events, (unsigned long long)rejected,
+		   (unsigned long long)replay_fires,
+		   (unsigned long long)hmcu_sim_irqCount(),
+		   (replay_fires != 0) ?
+				(double)replay_late_sum_us/(double)replay_fires : 0.0,
+		   (long long)replay_late_max_us, (long long)replay_early_max_us,
+		   (unsigned long long)(hmcu_sim_now()/1000u),
+		   replay_milliseconds() - t0);
+
+	if(trace != stdin){
+		fclose(trace);
+	}
+	return 0;
+}
@@ -0,0 +1,210 @@
+/**
+ * @file soft_timer_trace.c
+ *
+ * @brief Decoder of the binary event trace of the software timer.
+ *
+ * The input is the array of records copied by soft_timer_trace_dump() and
+ * written as it is to a file, or read from the memory of the target by a
+ * debugger. Every record takes 16 bytes, in little endian byte order:
+ *
+ *   time_us(4) timer(4) value(4) event(1) channel(1) sequence(2)
+ *
+ * One line per record is printed, with the time since the previous one,
+ * followed by a summary: the number of records per event, the records lost
+ * between the ones dumped, the most interrupts set within any window of
+ * window_us, which shows IRQ storms, and per timer the number of starts and
+ * expiries and the worst lateness, which shows starved timers:
+ *
+ *   soft_timer_trace trace.bin [window_us] [-s]
+ *
+ * Without a file name, or with "-", the trace is read from the standard
+ * input. With -s only the summary is printed. The window is 1000 us by
+ * default.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+/*****************************************************************************
+ * Private constants.
+ *****************************************************************************/
+#define TRACE_RECORD_SIZE		16
+#define TRACE_EVENTS			7
+#define TRACE_EVENT_START		2
+#define TRACE_EVENT_EXPIRE		5
+#define TRACE_EVENT_REPROGRAM	6
+#define TRACE_MAX_TIMERS		4096
+
+/*****************************************************************************
+ * Private types.
+ *****************************************************************************/
+typedef struct trace_record{
+	uint32_t				time_us;
+	uint32_t				timer;
+	uint32_t				value;
+	uint8_t					event;
+	uint8_t					channel;
+	uint16_t				sequence;
+}trace_record;
+
+typedef struct trace_timer{
+	uint32_t				starts;
+	uint32_t				expiries;
+	uint32_t				late_max_us;
+}trace_timer;
+
+/*****************************************************************************
+ * Global variables.
+ *****************************************************************************/
+static const char * const	trace_names[TRACE_EVENTS] =
+	{"create", "set", "start", "stop", "restart", "expire", "reprogram"};
+static trace_timer			trace_timers[TRACE_MAX_TIMERS];
+static uint64_t				trace_counts[TRACE_EVENTS + 1];
+
+/*****************************************************************************
+ * Bodies of private functions.
+ *****************************************************************************/
+
+static uint32_t trace_read32(const uint8_t * p_bytes){
+
+	return (uint32_t)p_bytes[0] | ((uint32_t)p_bytes[1] << 8) |
+		   ((uint32_t)p_bytes[2] << 16) | ((uint32_t)p_bytes[3] << 24);
+}
+
+static void trace_decode(const uint8_t * p_bytes, trace_record * p_record){
+
+	/* Decode the fields one by one, so the trace of a target of any byte
+	 * order or padding is read the same way. */
+	p_record->time_us = trace_read32(&p_bytes[0]);
+	p_record->timer = trace_read32(&p_bytes[4]);
+	p_record->value = trace_read32(&p_bytes[8]);
+	p_record->event = p_bytes[12];
+	p_record->channel = p_bytes[13];
+	p_record->sequence = (uint16_t)(p_bytes[14] | (p_bytes[15] << 8));
+}
+
+int main(int argc, char **argv){
+
+	FILE * input = stdin;
+	uint8_t bytes[TRACE_RECORD_SIZE];
+	trace_record record;
+	uint32_t * reprograms = NULL, * tmp_times;
+	uint64_t records = 0, lost = 0, capacity = 0, first = 0, i;
+	uint64_t storm_max = 0, storm_start = 0;
+	uint32_t previous_us = 0, window_us = 1000;
+	uint16_t sequence = 0;
+	bool summary = false;
+	const char * name;
+	int arg;
+
+	for(arg = 1 ; arg < argc ; arg++){
+		if(strcmp(argv[arg], "-s") == 0){
+			summary = true;
+		}else if((arg == 1) && (strcmp(argv[arg], "-") != 0)){
+			input = fopen(argv[arg], "rb");
+			if(input == NULL){
+				perror(argv[arg]);
+				return 1;
+			}
+		}else if(arg == 2){
+			window_us = (uint32_t)strtoul(argv[arg], NULL, 10);
+		}
+	}
+
+	if(!summary){
+		printf("%10s %10s %5s %3s %8s %-9s %10s\n", "time_us", "delta_us",
+			   "seq", "ch", "timer", "event", "value");
+	}
+
+	while(fread(bytes, sizeof(bytes), 1, input) == 1){
+
+		trace_decode(bytes, &record);
+
+		/* The sequence numbers of consecutive records follow each other,
+		 * unless records were overwritten or torn meanwhile. */
+		if((records != 0) && (record.sequence != (uint16_t)(sequence + 1))){
+			lost += (uint16_t)(record.sequence - sequence - 1);
+		}
+		sequence = record.sequence;
+
+		name = (record.event < TRACE_EVENTS) ? trace_names[record.event] :
+											   "unknown";
+		trace_counts[(record.event < TRACE_EVENTS) ? record.event :
+													 TRACE_EVENTS]++;
+		if(!summary){
+			printf("%10lu %10lu %5u %3u %8lu %-9s %10lu\n",
+				   (unsigned long)record.time_us,
+				   (unsigned long)((records != 0) ?
+								   record.time_us - previous_us : 0),
+				   record.sequence, record.channel,
+				   (unsigned long)record.timer, name,
+				   (unsigned long)record.value);
+		}
+		previous_us = record.time_us;
+		records++;
+
+		/* Keep the time of every setting of the registers, and the most of
+		 * them within the window ending at each one. */
+		if(record.event == TRACE_EVENT_REPROGRAM){
+			if(capacity <= trace_counts[TRACE_EVENT_REPROGRAM]){
+				capacity = (capacity != 0) ? 2*capacity : 1024;
+				tmp_times = realloc(reprograms, capacity*sizeof(uint32_t));
+				if(tmp_times == NULL){
+					free(reprograms);
+					return 1;
+				}
+				reprograms = tmp_times;
+			}
+			i = trace_counts[TRACE_EVENT_REPROGRAM] - 1;
+			reprograms[i] = record.time_us;
+			while(reprograms[i] - reprograms[first] >= window_us){
+				first++;
+			}
+			if(i - first + 1 > storm_max){
+				storm_max = i - first + 1;
+				storm_start = reprograms[first];
+			}
+		}
+
+		/* Account the starts, expiries and lateness of every timer. */
+		if((record.timer != 0) && (record.timer <= TRACE_MAX_TIMERS)){
+			if(record.event == TRACE_EVENT_START){
+				trace_timers[record.timer - 1].starts++;
+			}else if(record.event == TRACE_EVENT_EXPIRE){
+				trace_timers[record.timer - 1].expiries++;
+				if(record.value > trace_timers[record.timer - 1].late_max_us){
+					trace_timers[record.timer - 1].late_max_us = record.value;
+				}
+			}
+		}
+	}
+
+	printf("records=%llu lost=%llu", (unsigned long long)records,
+		   (unsigned long long)lost);
+	for(i = 0 ; i < TRACE_EVENTS ; i++){
+		printf(" %s=%llu", trace_names[i],
+			   (unsigned long long)trace_counts[i]);
+	}
+	printf(" unknown=%llu\n", (unsigned long long)trace_counts[TRACE_EVENTS]);
+	printf("reprograms_max=%llu per %lu us, from %lu us\n",
+		   (unsigned long long)storm_max, (unsigned long)window_us,
+		   (unsigned long)storm_start);
+	for(i = 0 ; i < TRACE_MAX_TIMERS ; i++){
+		if((trace_timers[i].starts != 0) || (trace_timers[i].expiries != 0)){
+			printf("timer=%llu starts=%lu expiries=%lu late_max_us=%lu\n",
+				   (unsigned long long)(i + 1),
+				   (unsigned long)trace_timers[i].starts,
+				   (unsigned long)trace_timers[i].expiries,
+				   (unsigned long)trace_timers[i].late_max_us);
+		}
+	}
+
+	free(reprograms);
+	if(input != stdin){
+		fclose(input);
+	}
+	return 0;
+}